@@ -2,6 +2,7 @@
 #define FAULT_TOLERANCE_CLIENT_H
 
 #include <vector>
+#include <unordered_map>
 
 #include <kvcg_logging.h>
 #include <kvcg_errors.h>
@@ -31,6 +32,16 @@ private:
   std::vector<ft::Shard*> shardList;
   std::vector<ft::Server*> serverList;
 
+  // Shard lookup index. shardBounds holds shard lower bounds in Eytzinger
+  // (BFS) order, 1-indexed, and shardRank maps each node back to its
+  // position in sortedShards.
+  std::vector<ft::Shard*> sortedShards;
+  std::vector<unsigned long long> shardBounds;
+  std::vector<size_t> shardRank;
+
+  void buildShardIndex();
+  size_t fillShardIndex(size_t node, size_t next);
+
 public:
   /**
    *
@@ -51,6 +62,39 @@ public:
    *
    */
   ft::Shard* getShard(unsigned long long key);
+
+  /**
+   *
+   * Group a batch of keys by the Shard storing them
+   *
+   * @param keys - keys to route
+   *
+   * @return map of Shard to the keys it stores. Keys not covered
+   *         by any Shard are grouped under nullptr.
+   *
+   */
+  std::unordered_map<ft::Shard*, std::vector<unsigned long long>> getShards(const std::vector<unsigned long long>& keys);
+
+  /**
+   *
+   * Discover the primary of every Shard, querying each server once
+   *
+   * @return status. 0 on success, non-zero if any Shard's primary was not found.
+   *
+   */
+  int rediscoverShards();
+
+  /**
+   *
+   * Set the primary of every Shard from the key ranges servers report
+   * as primary. A Shard no server reports keeps its current primary.
+   *
+   * @param ranges - primary key ranges of each server, in server list order
+   *
+   * @return status. 0 on success, non-zero if any Shard's primary was not found.
+   *
+   */
+  int assignPrimaries(const std::vector<std::vector<std::pair<unsigned long long, unsigned long long>>>& ranges);
 };
 
 #endif //FAULT_TOLERANCE_CLIENT_H
@@ -0,0 +1,20 @@
+#ifndef FAULT_TOLERANCE_FT_LOGGING_H
+#define FAULT_TOLERANCE_FT_LOGGING_H
+
+#include <kvcg_logging.h>
+
+// Most verbose level compiled in. Build with e.g. -DFT_LOG_FLOOR=WARNING
+// and FT_LOG statements above it are removed along with their arguments.
+// By default everything is compiled in and LOG_LEVEL decides at run time.
+#ifndef FT_LOG_FLOOR
+#define FT_LOG_FLOOR TRACE
+#endif
+
+// True if a statement at level would be printed
+#define FT_LOG_ENABLED(level) ((level) <= FT_LOG_FLOOR && (level) <= LOG_LEVEL)
+
+// LOG for the logging hot path. Arguments are only evaluated when the
+// statement is printed, and never compiled in above FT_LOG_FLOOR.
+#define FT_LOG(level) if (!FT_LOG_ENABLED(level)) {} else LOG(level)
+
+#endif // FAULT_TOLERANCE_FT_LOGGING_H
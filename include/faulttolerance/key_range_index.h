@@ -0,0 +1,75 @@
+#ifndef FAULT_TOLERANCE_KEY_RANGE_INDEX_H
+#define FAULT_TOLERANCE_KEY_RANGE_INDEX_H
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+// Forward declare KeyRangeIndex in namespace
+namespace cse498 {
+  namespace faulttolerance {
+    class KeyRangeIndex;
+  }
+}
+
+namespace ft = cse498::faulttolerance;
+
+/**
+ *
+ * Sorted, non-overlapping set of inclusive key ranges for O(log R) lookups.
+ *
+ * Writers build a new immutable snapshot and publish it with a single
+ * atomic store, readers only load the current snapshot and never lock.
+ * Replaced snapshots are kept until the index is destroyed, since a reader
+ * may still be searching one. Ranges only change on failover, so this is
+ * bounded by the number of reconfigurations.
+ *
+ */
+class ft::KeyRangeIndex {
+private:
+  typedef std::vector<std::pair<unsigned long long, unsigned long long>> RangeList;
+
+  std::atomic<const RangeList*> current;
+
+  // serializes writers and owns every published snapshot
+  std::mutex publishLock;
+  std::vector<std::unique_ptr<const RangeList>> snapshots;
+
+public:
+  KeyRangeIndex();
+  KeyRangeIndex(const KeyRangeIndex&) = delete;
+  KeyRangeIndex& operator=(const KeyRangeIndex&) = delete;
+
+  /**
+   *
+   * Replace the indexed ranges. Input may be unsorted and overlapping,
+   * ranges are sorted and merged before being published.
+   *
+   * @param ranges - list of min/max key range pairs
+   *
+   */
+  void publish(const std::vector<std::pair<unsigned long long, unsigned long long>>& ranges);
+
+  /**
+   *
+   * Check if a key falls within any indexed range
+   *
+   * @param key - key to look up
+   *
+   * @return true if key is covered, false otherwise
+   *
+   */
+  bool contains(unsigned long long key) const;
+
+  /**
+   *
+   * Get the sorted, merged ranges currently published
+   *
+   * @return vector of min/max key range pairs
+   *
+   */
+  std::vector<std::pair<unsigned long long, unsigned long long>> getRanges() const { return *current.load(std::memory_order_acquire); }
+};
+
+#endif // FAULT_TOLERANCE_KEY_RANGE_INDEX_H
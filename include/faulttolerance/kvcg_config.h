@@ -28,6 +28,22 @@ private:
   cse498::ProviderType provider;
   int serverPort;
   int clientPort;
+  bool parallelLogging;
+  size_t logSlotSize;
+  uint32_t logSlotEntries;
+  size_t maxValueSize;
+  std::string walDir;
+  size_t walSegmentSize;
+  std::string snapshotDir;
+  int snapshotIntervalMs;
+  int heartbeatIntervalMs;
+  int heartbeatTimeoutMs;
+  double phiThreshold;
+  int pollerThreads;
+  int pollerCpu;
+  size_t traceEvents;
+  std::vector<std::pair<std::pair<unsigned long long, unsigned long long>, ft::AckPolicy>> ackPolicies;
+  std::vector<std::pair<unsigned long long, unsigned long long>> compressRanges;
 
 public:
   /**
@@ -86,6 +102,150 @@ public:
    */
   int getClientPort() { return clientPort; }
 
+  /**
+   *
+   * Get whether log batches are sent to all backups concurrently
+   *
+   * @return true if parallel logging is enabled
+   *
+   */
+  bool getParallelLogging() { return parallelLogging; }
+
+  /**
+   *
+   * Get the bytes in each backup logging ring slot, the most sent in one write
+   *
+   * @return slot size in bytes
+   *
+   */
+  size_t getLogSlotSize() { return logSlotSize; }
+
+  /**
+   *
+   * Get the most log entries sent in one write
+   *
+   * @return entry limit, 0 for as many as fit in a slot
+   *
+   */
+  uint32_t getLogSlotEntries() { return logSlotEntries; }
+
+  /**
+   *
+   * Get the largest value that can be logged
+   *
+   * @return size in bytes
+   *
+   */
+  size_t getMaxValueSize() { return maxValueSize; }
+
+  /**
+   *
+   * Get the directory to keep the write-ahead log in
+   *
+   * @return directory, empty if the write-ahead log is disabled
+   *
+   */
+  std::string getWalDir() { return walDir; }
+
+  /**
+   *
+   * Get the size write-ahead log segments are preallocated to
+   *
+   * @return segment size in bytes
+   *
+   */
+  size_t getWalSegmentSize() { return walSegmentSize; }
+
+  /**
+   *
+   * Get the directory to save log history snapshots in
+   *
+   * @return directory, empty if snapshots are disabled
+   *
+   */
+  std::string getSnapshotDir() { return snapshotDir; }
+
+  /**
+   *
+   * Get the time between log history snapshots
+   *
+   * @return interval in milliseconds, 0 to only snapshot on request
+   *
+   */
+  int getSnapshotIntervalMs() { return snapshotIntervalMs; }
+
+  /**
+   *
+   * Get the time between heartbeats written to each backup
+   *
+   * @return interval in milliseconds
+   *
+   */
+  int getHeartbeatIntervalMs() { return heartbeatIntervalMs; }
+
+  /**
+   *
+   * Get the longest a primary's heartbeat may stay unchanged before it is assumed failed
+   *
+   * @return timeout in milliseconds
+   *
+   */
+  int getHeartbeatTimeoutMs() { return heartbeatTimeoutMs; }
+
+  /**
+   *
+   * Get the phi accrual suspicion level a primary is assumed failed at
+   *
+   * @return threshold, 0 if only the heartbeat timeout is used
+   *
+   */
+  double getPhiThreshold() { return phiThreshold; }
+
+  /**
+   *
+   * Get the number of threads polling the primaries this server backs up
+   *
+   * @return thread count
+   *
+   */
+  int getPollerThreads() { return pollerThreads; }
+
+  /**
+   *
+   * Get the CPU the first poller thread is pinned to, the others take the CPUs after it
+   *
+   * @return CPU index, -1 if pollers are not pinned
+   *
+   */
+  int getPollerCpu() { return pollerCpu; }
+
+  /**
+   *
+   * Get the number of recent trace events kept
+   *
+   * @return trace ring size, 0 if tracing is disabled
+   *
+   */
+  size_t getTraceEvents() { return traceEvents; }
+
+  /**
+   *
+   * Get the acknowledgement policy of each primary key range
+   *
+   * @return key ranges and their AckPolicy
+   *
+   */
+  std::vector<std::pair<std::pair<unsigned long long, unsigned long long>, ft::AckPolicy>> getAckPolicies() { return ackPolicies; }
+
+  /**
+   *
+   * Get the primary key ranges whose log batches are compressed
+   *
+   * @return key ranges
+   *
+   */
+  std::vector<std::pair<unsigned long long, unsigned long long>> getCompressRanges() { return compressRanges; }
+
 };
 
 #endif // KVCG_CONFIG_H
@@ -0,0 +1,154 @@
+#ifndef FAULT_TOLERANCE_LOG_ARENA_H
+#define FAULT_TOLERANCE_LOG_ARENA_H
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include <data_t.hh>
+#include <RequestWrapper.hh>
+
+// Smallest size class handed out by the arena, classes double from here
+#define LOG_ARENA_MIN_CLASS 16
+// Memory is carved out of slabs of this size
+#define LOG_ARENA_SLAB_SIZE (64*1024)
+// Number of size classes, enough for any size_t allocation
+#define LOG_ARENA_NUM_CLASSES 60
+
+// Forward declare LogArena in namespace
+namespace cse498 {
+  namespace faulttolerance {
+    class LogArena;
+  }
+}
+
+namespace ft = cse498::faulttolerance;
+
+/**
+ *
+ * Size-classed slab allocator for log history entries.
+ *
+ * Blocks are rounded up to a power of two size class and recycled
+ * through a free list per class, so once a server has seen its working
+ * set of value sizes, updating log history does not touch malloc/free.
+ * Memory is only returned when the arena is destroyed.
+ *
+ * Not thread safe, callers serialize access (Server uses logged_putsLock).
+ *
+ */
+class ft::LogArena {
+public:
+  // Entry as allocated by allocEntry, callers get a pointer to req
+  struct Entry {
+    RequestWrapper<unsigned long long, data_t*> req;
+    uint64_t seq; // log sequence number of the last update
+  };
+
+private:
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  // free list head per size class
+  std::vector<FreeBlock*> freeLists;
+
+  // all memory owned by the arena
+  std::vector<char*> slabs;
+  char* slabCur = nullptr;
+  size_t slabLeft = 0;
+
+  char* carve(size_t size);
+
+public:
+  LogArena() : freeLists(LOG_ARENA_NUM_CLASSES, nullptr) {}
+  LogArena(const LogArena&) = delete;
+  LogArena& operator=(const LogArena&) = delete;
+  ~LogArena();
+
+  /**
+   *
+   * Get the size class index for an allocation
+   *
+   * @param size - requested size in bytes
+   *
+   * @return index of the size class that fits size
+   *
+   */
+  static size_t classIndex(size_t size);
+
+  /**
+   *
+   * Get the number of bytes actually reserved for an allocation
+   *
+   * @param size - requested size in bytes
+   *
+   * @return capacity of the block returned by allocate(size)
+   *
+   */
+  static size_t classSize(size_t size);
+
+  /**
+   *
+   * Allocate a block of at least size bytes
+   *
+   * @param size - requested size in bytes
+   *
+   * @return pointer to block
+   *
+   */
+  char* allocate(size_t size);
+
+  /**
+   *
+   * Return a block to the arena
+   *
+   * @param p - block returned by allocate
+   * @param size - size that was passed to allocate
+   *
+   */
+  void release(char* p, size_t size);
+
+  /**
+   *
+   * Allocate a log history entry with a value buffer of size bytes
+   *
+   * @param key - key of the entry
+   * @param size - size of the value
+   *
+   * @return entry, value->size is set to size
+   *
+   */
+  RequestWrapper<unsigned long long, data_t*>* allocEntry(unsigned long long key, size_t size);
+
+  /**
+   *
+   * Resize the value buffer of an entry, reusing it if the size class does not change
+   *
+   * @param entry - entry returned by allocEntry
+   * @param size - new size of the value
+   *
+   */
+  void resizeEntry(RequestWrapper<unsigned long long, data_t*>* entry, size_t size);
+
+  /**
+   *
+   * Return an entry and its value buffer to the arena
+   *
+   * @param entry - entry returned by allocEntry
+   *
+   */
+  void releaseEntry(RequestWrapper<unsigned long long, data_t*>* entry);
+
+  /**
+   *
+   * Get the log sequence number stored with an entry
+   *
+   * @param entry - entry returned by allocEntry
+   *
+   * @return reference to the entry's sequence number
+   *
+   */
+  static uint64_t& seq(RequestWrapper<unsigned long long, data_t*>* entry) { return ((Entry*)entry)->seq; }
+};
+
+#endif // FAULT_TOLERANCE_LOG_ARENA_H
@@ -0,0 +1,267 @@
+#ifndef FAULT_TOLERANCE_LOG_BATCH_H
+#define FAULT_TOLERANCE_LOG_BATCH_H
+
+#include <cstdint>
+#include <cstddef>
+
+#include <data_t.hh>
+#include <RequestWrapper.hh>
+
+// Wire format of a batch of log entries, bump when it changes
+#define LOG_BATCH_VERSION 4
+// Batch header: type, version, flags, entry count, payload length, sequence
+// number, base sequence number
+#define LOG_BATCH_HDR_SIZE (2 + sizeof(uint16_t) + 2*sizeof(uint32_t) + 2*sizeof(uint64_t))
+// Longest LEB128 encoding of a 64-bit integer
+#define LOG_BATCH_MAX_VARINT 10
+// Header flag: payload is a u32 raw payload length then an ft::Lz block
+#define LOG_BATCH_COMPRESSED 0x1
+#define LOG_BATCH_KNOWN_FLAGS LOG_BATCH_COMPRESSED
+// Payloads smaller than this are not worth compressing
+#define LOG_BATCH_COMPRESS_MIN 256
+
+// Forward declare LogBatchWriter and LogBatchReader in namespace
+namespace cse498 {
+  namespace faulttolerance {
+    class LogBatchWriter;
+    class LogBatchReader;
+  }
+}
+
+namespace ft = cse498::faulttolerance;
+
+/**
+ *
+ * Builds a batch of log entries in a caller's buffer.
+ *
+ * Layout: a LOG_BATCH_HDR_SIZE header, then per entry
+ *   varint  zigzag delta of the key from the previous entry's key
+ *   varint  zigzag delta of the sequence number from the previous entry's,
+ *           the first entry's from the base sequence number
+ *   varint  value length << 2 | type bits (0 INSERT, 1 REMOVE, 2 other, 3 chunk)
+ *   varint  requestInteger, only for type bits 2 and 3
+ *   varint  full value length then offset of this part, only for type bits 3
+ *   bytes   value, or this part of it
+ * Batches are usually sorted or clustered by key, so most key deltas
+ * and value lengths take a byte or two.
+ *
+ * A value too large for one batch is sent as chunk entries in order,
+ * over as many batches as it takes.
+ *
+ * The base sequence number is the sequence number of the batch sent
+ * before this one, so a reader can tell it has not missed any.
+ *
+ */
+class ft::LogBatchWriter {
+private:
+  char* buf;
+  size_t capacity;
+  uint32_t maxEntries;
+  size_t len = LOG_BATCH_HDR_SIZE;
+  uint32_t count = 0;
+  unsigned long long prevKey = 0;
+  uint64_t seq = 0;
+  uint64_t baseSeq = 0;
+  uint64_t prevSeq = 0;
+  bool compressed = false;
+
+public:
+  /**
+   *
+   * @param buf - where to build the batch
+   * @param capacity - bytes available in buf, at least LOG_BATCH_HDR_SIZE
+   * @param maxEntries - most entries in a batch, 0 for as many as fit
+   *
+   */
+  LogBatchWriter(char* buf, size_t capacity, uint32_t maxEntries = 0) :
+    buf(buf), capacity(capacity), maxEntries(maxEntries) {}
+
+  /**
+   *
+   * Start a new empty batch in the same buffer, with the same base
+   * sequence number
+   *
+   */
+  void reset();
+
+  /**
+   *
+   * Set the base sequence number of the batch, only while it is empty
+   *
+   * @param base - sequence number of the last batch sent before this one
+   *
+   */
+  void setBaseSeq(uint64_t base) { baseSeq = base; prevSeq = base; }
+
+  /**
+   *
+   * Get the sequence number the batch carries
+   *
+   * @return sequence number of the last entry added, 0 if none
+   *
+   */
+  uint64_t getSeq() { return seq; }
+
+  /**
+   *
+   * Add an entry if it fits
+   *
+   * @param req - request to add
+   * @param seq - log sequence number of req, the batch carries the last one
+   *
+   * @return true if added, false if the buffer is too full or has maxEntries
+   *
+   */
+  bool append(const RequestWrapper<unsigned long long, data_t *>& req, uint64_t seq);
+
+  /**
+   *
+   * Add as much of req's value starting at offset as fits, as a chunk entry
+   *
+   * @param req - request to add part of
+   * @param offset - first byte of the value to add
+   * @param seq - log sequence number of req, carried once the last chunk is added
+   *
+   * @return bytes of the value added, 0 if the buffer is too full
+   *
+   */
+  size_t appendChunk(const RequestWrapper<unsigned long long, data_t *>& req, size_t offset, uint64_t seq);
+
+  /**
+   *
+   * Write the header for the entries added so far. With scratch, the
+   * payload is compressed in place if that saves at least an eighth of
+   * it, otherwise it is left as is. Either way reset before appending
+   * again.
+   *
+   * @param scratch - buffer of at least capacity bytes to compress
+   *        through, nullptr to not compress
+   *
+   * @return bytes of buf to send
+   *
+   */
+  size_t finish(char* scratch = nullptr);
+
+  /**
+   *
+   * Check if the last finish compressed the payload
+   *
+   * @return true if compressed
+   *
+   */
+  bool isCompressed() { return compressed; }
+
+  /**
+   *
+   * Get number of entries added
+   *
+   * @return entry count
+   *
+   */
+  uint32_t size() { return count; }
+
+  bool empty() { return count == 0; }
+};
+
+/**
+ *
+ * Reads the entries of a batch built by LogBatchWriter in place.
+ *
+ */
+class ft::LogBatchReader {
+private:
+  const char* buf = nullptr;
+  size_t len = 0;
+  size_t pos = 0;
+  uint32_t count = 0;
+  uint32_t read = 0;
+  uint16_t flags = 0;
+  unsigned long long prevKey = 0;
+  uint64_t seq = 0;
+  uint64_t baseSeq = 0;
+  uint64_t entrySeq = 0;
+  bool chunk = false;
+  uint64_t chunkOffset = 0;
+  uint64_t chunkTotal = 0;
+
+public:
+  /**
+   *
+   * Check the header of a batch and prepare to read its entries
+   *
+   * @param buf - start of the batch
+   * @param size - bytes readable at buf
+   * @param scratch - where a compressed payload is decompressed to,
+   *        entries then point into scratch instead of buf
+   * @param scratchSize - bytes available in scratch
+   *
+   * @return status. 0 on success, KVCG_EINVALID if not a batch this version can read
+   *         or it is compressed and does not decompress into scratch.
+   *
+   */
+  int open(const char* buf, size_t size, char* scratch = nullptr, size_t scratchSize = 0);
+
+  /**
+   *
+   * Decode the next entry. The value is left in the batch. For a chunk
+   * entry, req->value is only the part at getChunkOffset.
+   *
+   * @param req - filled in, req->value must point at a data_t to fill in
+   *
+   * @return true if an entry was read, false at the end or if the batch is malformed
+   *
+   */
+  bool next(RequestWrapper<unsigned long long, data_t *>* req);
+
+  /**
+   *
+   * Check if the entry last read is one chunk of a larger value
+   *
+   * @return true for a chunk entry
+   *
+   */
+  bool isChunk() { return chunk; }
+  uint64_t getChunkOffset() { return chunkOffset; }
+  uint64_t getChunkTotal() { return chunkTotal; } // full value length
+
+  /**
+   *
+   * Check if every entry in the header count was read
+   *
+   * @return true when done
+   *
+   */
+  bool done() { return read == count; }
+
+  uint32_t size() { return count; }
+  uint16_t getFlags() { return flags; }
+
+  /**
+   *
+   * Get the sequence number of the last entry in the batch
+   *
+   * @return sequence number, 0 if not numbered
+   *
+   */
+  uint64_t getSeq() { return seq; }
+
+  /**
+   *
+   * Get the sequence number of the batch sent before this one
+   *
+   * @return base sequence number
+   *
+   */
+  uint64_t getBaseSeq() { return baseSeq; }
+
+  /**
+   *
+   * Get the sequence number of the entry last read
+   *
+   * @return sequence number
+   *
+   */
+  uint64_t getEntrySeq() { return entrySeq; }
+};
+
+#endif // FAULT_TOLERANCE_LOG_BATCH_H
@@ -0,0 +1,70 @@
+#ifndef FAULT_TOLERANCE_LZ_H
+#define FAULT_TOLERANCE_LZ_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Bits of the match finder hash table, 4 bytes per entry
+#define LZ_HASH_LOG 12
+// Shortest match worth encoding
+#define LZ_MIN_MATCH 4
+// Matches look back at most this far
+#define LZ_MAX_OFFSET 65535
+
+// Forward declare Lz in namespace
+namespace cse498 {
+  namespace faulttolerance {
+    class Lz;
+  }
+}
+
+namespace ft = cse498::faulttolerance;
+
+/**
+ *
+ * Fast LZ77 block codec in the style of LZ4.
+ *
+ * A block is a run of sequences, each a token byte (literal count in
+ * the high nibble, match length - LZ_MIN_MATCH in the low nibble), any
+ * extra length bytes, the literals, then a 2-byte little endian offset
+ * back into the output and any extra match length bytes. A nibble of 15
+ * is continued by bytes that are added on until one is below 255. The
+ * last sequence has only literals.
+ *
+ * Matches are found with a single hash probe per position, trading ratio
+ * for speed; decoding is a loop of copies.
+ *
+ */
+class ft::Lz {
+public:
+  /**
+   *
+   * Compress a block
+   *
+   * @param src - data to compress
+   * @param len - bytes in src
+   * @param dst - compressed output
+   * @param capacity - bytes available in dst
+   *
+   * @return compressed size, 0 if it does not fit in capacity
+   *
+   */
+  static size_t compress(const char* src, size_t len, char* dst, size_t capacity);
+
+  /**
+   *
+   * Decompress a block
+   *
+   * @param src - compressed block
+   * @param len - bytes in src
+   * @param dst - decompressed output
+   * @param capacity - bytes available in dst
+   * @param outLen - set to the decompressed size
+   *
+   * @return status. 0 on success, KVCG_EINVALID if src is malformed or does not fit in dst.
+   *
+   */
+  static int decompress(const char* src, size_t len, char* dst, size_t capacity, size_t* outLen);
+};
+
+#endif // FAULT_TOLERANCE_LZ_H
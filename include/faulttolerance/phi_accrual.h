@@ -0,0 +1,119 @@
+#ifndef FAULT_TOLERANCE_PHI_ACCRUAL_H
+#define FAULT_TOLERANCE_PHI_ACCRUAL_H
+
+#include <vector>
+#include <chrono>
+#include <cstddef>
+
+// Heartbeat inter-arrival times kept to estimate their distribution
+#define PHI_WINDOW 200
+// Default suspicion level a primary is assumed failed at, phi of 8
+// is a 1 in 10^8 chance a heartbeat is only late
+#define PHI_THRESHOLD 8.0
+
+// Forward declare PhiAccrualDetector in namespace
+namespace cse498 {
+  namespace faulttolerance {
+    class PhiAccrualDetector;
+  }
+}
+
+namespace ft = cse498::faulttolerance;
+
+/**
+ *
+ * Phi accrual failure detector (Hayashibara et al.) for one peer.
+ *
+ * Keeps the last PHI_WINDOW times between heartbeats and models them
+ * as a normal distribution. phi is -log10 of the chance that the next
+ * heartbeat is still coming given how long it has been, so the wait
+ * before suspecting a peer stretches on its own when heartbeats are
+ * jittery and shrinks when they are steady.
+ *
+ * Not thread safe, used by the thread watching the peer.
+ *
+ */
+class ft::PhiAccrualDetector {
+private:
+  std::vector<double> intervals; // ring of the last PHI_WINDOW, in ms
+  size_t next = 0;
+  double sum = 0;
+  double sumSq = 0;
+  double minStdDevMs;
+  double expectedIntervalMs;
+  bool started = false;
+  std::chrono::steady_clock::time_point last;
+
+  void addInterval(double ms);
+
+public:
+  /**
+   *
+   * @param expectedIntervalMs - heartbeat interval the peer is configured with,
+   *        seeds the distribution until real samples replace it
+   * @param minStdDevMs - floor on the standard deviation, so a run of very
+   *        regular heartbeats does not make the detector hair-trigger
+   *
+   */
+  PhiAccrualDetector(double expectedIntervalMs, double minStdDevMs);
+
+  /**
+   *
+   * Forget every sample, e.g. when watching a different peer
+   *
+   */
+  void reset();
+
+  /**
+   *
+   * Record a heartbeat arrival
+   *
+   * @param now - arrival time
+   *
+   */
+  void heartbeat(std::chrono::steady_clock::time_point now);
+
+  /**
+   *
+   * Record proof of life other than a heartbeat, e.g. other traffic from
+   * the peer. Restarts the wait for the next heartbeat without adding a
+   * sample, since such traffic does not follow the heartbeat interval.
+   *
+   * @param now - arrival time
+   *
+   */
+  void alive(std::chrono::steady_clock::time_point now);
+
+  /**
+   *
+   * Get the suspicion level that the peer failed
+   *
+   * @param now - time to evaluate at
+   *
+   * @return phi, 0 before the first heartbeat
+   *
+   */
+  double phi(std::chrono::steady_clock::time_point now);
+
+  /**
+   *
+   * Get the mean time between heartbeats
+   *
+   * @return mean in milliseconds
+   *
+   */
+  double getMeanMs() { return sum / intervals.size(); }
+
+  /**
+   *
+   * Get time since the last heartbeat
+   *
+   * @param now - time to measure to
+   *
+   * @return milliseconds, 0 before the first heartbeat
+   *
+   */
+  double sinceLastMs(std::chrono::steady_clock::time_point now);
+};
+
+#endif // FAULT_TOLERANCE_PHI_ACCRUAL_H
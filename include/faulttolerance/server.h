@@ -7,6 +7,11 @@
 #include <map>
 #include <functional>
 #include <chrono>
+#include <deque>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <atomic>
 
 #include <kvcg_logging.h>
 #include <kvcg_errors.h>
@@ -18,13 +23,65 @@
 #include <RequestWrapper.hh>
 
 #include <faulttolerance/node.h>
-
+#include <faulttolerance/log_arena.h>
+#include <faulttolerance/key_range_index.h>
+#include <faulttolerance/wal.h>
+#include <faulttolerance/snapshot.h>
+#include <faulttolerance/timer_wheel.h>
+#include <faulttolerance/phi_accrual.h>
+#include <faulttolerance/trace_ring.h>
+
+// Default bytes in each logging ring slot, the most written to a backup at once
 #define MAX_LOG_SIZE 4096
+// Bounds on the configured slot size, the batch header counts payload in 32 bits
+#define LOG_SLOT_MIN_SIZE 256
+#define LOG_SLOT_MAX_SIZE (1 << 30)
+// Default largest value that can be logged, values are stored with 32-bit sizes
+#define MAX_VALUE_SIZE (64 << 20)
+
+// Number of slots in each backup logging ring
+#define LOG_RING_SLOTS 8
+// Control block at the start of the ring, backup publishes its tail index here
+#define LOG_RING_HDR_SIZE 64
+#define LOG_RING_SIZE(slotSize) (LOG_RING_HDR_SIZE + LOG_RING_SLOTS*(size_t)(slotSize))
+// Each 'l' slot holds one batch in the ft::LogBatchWriter format
+// After a batch does not compress, this many more are sent as is
+#define LOG_COMPRESS_BACKOFF 8
+
+// Default time between heartbeats written to each backup
+#define HB_INTERVAL_MS 50
+// Default longest time without a new heartbeat before a primary is assumed failed
+#define HB_TIMEOUT_MS 500
+// Heartbeat scheduler ticks per heartbeat interval, spreads backups' beats out
+#define HB_WHEEL_RESOLUTION 8
+
+// Idle primary polling backs off from spinning, to yielding, to sleeping
+#define POLL_SPIN_ROUNDS 1000
+#define POLL_YIELD_ROUNDS 100
+#define POLL_SLEEP_US 200
+
+// Size of the pre-serialized primary key range list clients read
+#define DISCOVERY_SIZE MAX_LOG_SIZE
+// Discovery handshake: MR key, MR address, then a copy of the range list
+#define DISCOVERY_MSG_SIZE (2*sizeof(uint64_t) + DISCOVERY_SIZE)
+// Threads completing handshakes for new discovery clients
+#define DISCOVERY_THREADS 2
+// Client connections kept open, oldest are closed beyond this
+#define DISCOVERY_MAX_CLIENTS 1024
 
 // Forward declare Server in namespace
 namespace cse498 {
   namespace faulttolerance {
     class Server;
+
+    // How many backups must receive a logged request before logRequest returns
+    enum AckPolicy {
+      ACK_DEFAULT, // use the policy configured for the key's range
+      ACK_ALL,     // every live backup tracking the key
+      ACK_QUORUM,  // a majority of live backups tracking the key
+      ACK_ONE,     // the first backup to receive it
+      ACK_ASYNC    // do not wait, backups receive it in the background
+    };
   }
 }
 
@@ -40,15 +97,47 @@ private:
   // For server-server communication
   int serverPort;
 
+  // Send log batches to all backups concurrently
+  bool parallelLogging = true;
+
+  // Bytes in each logging ring slot and most entries written to one
+  // (0 for no limit), configured the same across the cluster
+  size_t logSlotSize = MAX_LOG_SIZE;
+  uint32_t logSlotEntries = 0;
+  // Largest value logged or accepted from a primary, configured the same across the cluster
+  size_t maxValueSize = MAX_VALUE_SIZE;
+
   // Caller's function to commit logs to table
   std::function<void(std::vector<RequestWrapper<unsigned long long, data_t *>>)> commitFn = NULL;
 
-  // For this instance, tracks primary keys
+  // For this instance, tracks primary keys. Any change must be
+  // republished with publishPrimaryKeys for isPrimary and discovery.
   std::mutex primaryKeysLock;
   std::vector<std::pair<unsigned long long, unsigned long long>> primaryKeys;
+  ft::KeyRangeIndex primaryKeyIndex;
+
+  // primaryKeys serialized for clients to RDMA read, rebuilt on change
+  cse498::unique_buf discovery_mr{DISCOVERY_SIZE};
+  uint64_t discoveryVersion = 0;
+
+  // Discovery clients waiting on a handshake, and those connected
+  std::mutex discoveryQueueLock;
+  std::condition_variable discoveryQueueCv;
+  std::deque<cse498::Connection*> discoveryQueue;
+  std::deque<cse498::Connection*> discoveryConns;
+  std::vector<std::thread*> discovery_threads;
+
+  // Client side connection to this server's discovery service
+  std::mutex discoveryLock;
+  cse498::Connection* discovery_conn = nullptr;
+  cse498::unique_buf discovery_buf{DISCOVERY_MSG_SIZE};
+  uint64_t discovery_key;
+  uint64_t discovery_addr;
 
   // For other servers in backupServers, keys is the ranges they backup for this instance
+  std::mutex backupKeysLock;
   std::vector<std::pair<unsigned long long, unsigned long long>> backupKeys;
+  ft::KeyRangeIndex backupKeyIndex;
 
   std::vector<ft::Server*> backupServers; // servers backing up this ones primaries
   std::vector<ft::Server*> primaryServers; // servers whose keys this one is backing up
@@ -59,37 +148,213 @@ private:
   std::vector<ft::Server*> originalPrimaryServers;
 
   std::thread *client_listen_thread = nullptr;
-  std::vector<std::thread*> primary_listen_threads;
-  std::vector<std::thread*> heartbeat_threads;
 
-  // backups will add here per primary
+  // A primary we are backing up, polled by one of the pollers
+  struct PrimaryWatch {
+    ft::Server* primServer;
+    bool started = false; // got its first heartbeat
+    uint64_t heartbeat = 0;
+    ft::PhiAccrualDetector detector;
+    std::vector<char> scratch; // compressed batches are decompressed here
+    // value being put back together from chunks, empty if none
+    unsigned long long chunkKey = 0;
+    std::vector<char> chunkData;
+    size_t chunkReceived = 0;
+
+    PrimaryWatch(ft::Server* primServer, double intervalMs, double minStdDevMs, size_t slotSize) :
+      primServer(primServer), detector(intervalMs, minStdDevMs), scratch(slotSize) {}
+  };
+
+  // Thread polling the logging rings and heartbeats of its PrimaryWatches
+  struct Poller {
+    std::thread* thread = nullptr;
+    std::mutex lock;
+    std::vector<PrimaryWatch*> added; // new watches for the poller to take, guarded by lock
+    std::atomic<bool> hasAdded{false};
+  };
+  std::vector<std::unique_ptr<Poller>> pollers;
+  std::atomic<unsigned int> nextPoller{0};
+
+  enum PollResult {
+    POLL_IDLE, // nothing new from the primary
+    POLL_WORK, // handled something
+    POLL_DONE  // primary failed or moved, stop watching it
+  };
+
+  // Single thread writing heartbeats to every backup, each backup has
+  // a timer in heartbeatWheel for its next beat
+  std::thread *heartbeat_thread = nullptr;
+  std::mutex heartbeatLock;
+  ft::TimerWheel heartbeatWheel; // guarded by heartbeatLock
+  int heartbeatIntervalMs = HB_INTERVAL_MS;
+  int heartbeatTimeoutMs = HB_TIMEOUT_MS;
+  // Reconnecting backups whose heartbeat failed, joined on shutdown
+  std::mutex recoverLock;
+  std::vector<std::thread> recoverThreads; // guarded by recoverLock
+  // Resolving failed primaries, started by pollers and joined on shutdown
+  std::mutex failoverLock;
+  std::vector<std::thread> failoverThreads; // guarded by failoverLock
+  double phiThreshold = PHI_THRESHOLD; // 0 to only use heartbeatTimeoutMs
+
+  // backups will add here per primary. Only keys that have been
+  // logged have an entry, see setLogEntry.
   std::mutex logged_putsLock;
   std::map<unsigned long long, RequestWrapper<unsigned long long, data_t*>*> *logged_puts = new std::map<unsigned long long, RequestWrapper<unsigned long long, data_t*>*>();
+  // entries and values in logged_puts are allocated here, guarded by logged_putsLock
+  ft::LogArena logArena;
+
+  // Optional on-disk copy of everything this server logs as a primary,
+  // replayed on initialize
+  ft::WriteAheadLog wal;
 
+  // Log history is periodically saved here, empty if disabled
+  std::string snapshotDir;
+  int snapshotIntervalMs = 0;
+  std::thread *snapshot_thread = nullptr;
+
+  // Recent per-request events, empty if disabled
+  ft::TraceRing trace;
+
+  // Heartbeats are a 64-bit counter, 0 until the first beat
   cse498::unique_buf heartbeat_mr;
   uint64_t heartbeat_key;
   uint64_t heartbeat_addr;
+  // On a backup, the last beat we wrote to it and where it is sent from
+  uint64_t heartbeatCount = 0;
+  cse498::unique_buf heartbeatSendBuf{sizeof(uint64_t)};
+  uint64_t heartbeatSendBufKey = 3;
+  bool heartbeating = false; // has a timer in our heartbeatWheel, guarded by our heartbeatLock
+  std::atomic<std::chrono::steady_clock::time_point> lastLogWrite{}; // heartbeats are skipped after one
 
   // when logging,
   std::mutex logCheckBufLock;
   cse498::unique_buf logCheckBuf;  // read remote check byte here
   std::mutex logDataBufLock;
   cse498::unique_buf logDataBuf;   // copy log data to send to remote here
+  std::vector<char> compressBuf;   // compress log data through here
+  int compressSkip = 0;            // batches left to send uncompressed
   // random unused keys
   uint64_t logCheckBufKey = 44;
   uint64_t logDataBufKey = 55;
 
-  cse498::unique_buf logging_mr;
+  // This server's log stream as known here. For ourselves, the epoch
+  // (random per boot) updates are numbered in and the last number handed
+  // out. For a primary, its epoch and the last number we applied from it.
+  uint64_t logEpoch = 0;
+  std::atomic<uint64_t> logSeq{0};
+  // For a backup, what it had of our stream when it last connected
+  uint64_t remoteLogEpoch = 0;
+  uint64_t remoteLogSeq = 0;
+  // For a backup, sequence number of the last batch written to it, the
+  // next batch's base. Guarded by logDataBufLock.
+  uint64_t logSentSeq = 0;
+
+  // Senders to this backup take a ticket when their group is formed and
+  // write in ticket order, so groups reach it in the order they were sent
+  std::mutex logOrderLock;
+  std::condition_variable logOrderCv;
+  uint64_t logTicketNext = 0;
+  uint64_t logTicketServing = 0;
+
+  // Ring of LOG_RING_SLOTS batches the primary writes into, preceded by
+  // a control block holding the backup's tail index
+  cse498::unique_buf logging_mr{LOG_RING_SIZE(MAX_LOG_SIZE)};
   uint64_t logging_mr_key;
   uint64_t logging_mr_addr;
 
-  void beat_heart(ft::Server* backup);
+  // Logging ring indices (monotonic, slot is index % LOG_RING_SLOTS).
+  // On a backup, logRingHead is the next slot we write to it and logRingTailCache
+  // is the last tail we read from it. On a primary, logRingNext is the next slot
+  // we consume from it.
+  uint64_t logRingHead = 0;
+  uint64_t logRingTailCache = 0;
+  uint64_t logRingNext = 0;
+
+  // A logRequest caller waiting for its batch to be group committed.
+  // Async requests own their batch and are completed through callback.
+  struct LogGroupRequest {
+    const std::vector<RequestWrapper<unsigned long long, data_t *>>* batch;
+    std::vector<RequestWrapper<unsigned long long, data_t *>>* failedBatch;
+    int status = KVCG_ESUCCESS;
+    bool done = false;
+    std::vector<RequestWrapper<unsigned long long, data_t *>> ownedBatch;
+    std::vector<RequestWrapper<unsigned long long, data_t *>> ownedFailedBatch;
+    std::function<void(int, std::vector<RequestWrapper<unsigned long long, data_t *>>&)> callback = NULL;
+    ft::AckPolicy ackPolicy = ft::ACK_DEFAULT;
+  };
+
+  // One log group as seen by its backup senders. Shared with them since
+  // senders keep going after callers are released by a non-ALL policy.
+  struct LogShipment {
+    std::vector<RequestWrapper<unsigned long long, data_t *>> batch;
+    std::vector<uint64_t> seqs; // log sequence number of each request
+    // copies of the callers' values, only made when senders may outlive them
+    std::vector<std::unique_ptr<char[]>> values;
+    std::vector<data_t> valueData;
+    std::vector<std::vector<bool>> marks;   // per backup, written by its sender
+    std::vector<std::vector<bool>> invalid; // per backup, written by its sender
+    std::mutex lock;
+    std::condition_variable cv;
+    // guarded by lock
+    std::vector<int> acks;        // backups that have each request
+    std::vector<bool> anyInvalid; // request can not be logged
+    int sendersLeft = 0;
+  };
+
+  // Configured AckPolicy of every key range, sorted by minKey
+  std::vector<std::pair<std::pair<unsigned long long, unsigned long long>, ft::AckPolicy>> ackPolicies;
+  // Key ranges whose log batches are compressed, sorted by minKey
+  std::vector<std::pair<unsigned long long, unsigned long long>> compressRanges;
+
+  // Concurrent logRequest callers queue here. One of them at a time is
+  // the leader, sending everything queued so far as a single group.
+  std::mutex logGroupLock;
+  std::condition_variable logGroupCv;
+  std::vector<LogGroupRequest*> logGroupQueue;
+  bool logGroupLeader = false;
+  // leads groups for async requests when no caller is waiting to
+  std::thread *log_ship_thread = nullptr;
+  bool logShipStop = false; // guarded by logGroupLock
+  // Sender threads still writing a group, drained on shutdown
+  std::mutex shipLock;
+  std::condition_variable shipCv;
+  int shipsInFlight = 0; // guarded by shipLock
+
+  void heartbeat_loop(); // write heartbeats to backups as their timers expire
+  void startHeartbeat(ft::Server* backup);
+  void recoverBackup(ft::Server* backup); // reconnect a backup whose heartbeat failed
   void client_listen(); // listen for client connections
-  void primary_listen(ft::Server* pserver); // listen for backup request from another primary
+  void discovery_handshake(); // hand new discovery clients the range list
+  void publishPrimaryKeys();
+  void watchPrimary(ft::Server* primServer); // start applying backup requests from another primary
+  PollResult pollPrimary(PrimaryWatch* watch, std::chrono::steady_clock::time_point now);
+  void poll_primaries(Poller* poller, int cpu); // poll a set of primaries, pinned to cpu if not -1
+  void failover(ft::Server* primServer, ft::Server* expNewPrimary); // resolve a failed primary and watch its successor
+  void startFailover(ft::Server* primServer, ft::Server* expNewPrimary); // run failover on its own thread
   ft::Server* handlePrimaryFailure(ft::Server* primServer, ft::Server* expNewPrimary = nullptr);
-  int open_backup_endpoints(ft::Server* primServer = NULL, char state = 'b', int timeout = 0, int* ret = NULL);
+  int open_backup_endpoints(ft::Server* primServer = NULL, char state = 'b', int timeoutMs = 0, int* ret = NULL);
   int open_client_endpoint();
   int connect_backups(ft::Server* newBackup = NULL, bool waitForDead = false);
+  bool writeLogSlot(ft::Server* backup, cse498::unique_buf& buf, size_t len); // false if dropped on shutdown
+  int logToBackup(ft::Server* backup, const std::vector<RequestWrapper<unsigned long long, data_t *>>& batch, const std::vector<uint64_t>& seqs, std::vector<bool>& backedUp, std::vector<bool>& invalid);
+  void commitLogGroup(std::vector<LogGroupRequest*>& group);
+  void shipToBackup(std::shared_ptr<LogShipment> ship, ft::Server* backup, uint64_t ticket, int i);
+  void waitLogTicket(ft::Server* backup, uint64_t ticket); // wait for earlier writes to backup
+  void doneLogTicket(ft::Server* backup);                  // let the next ticket write
+  void pauseLogGroups();  // become the log group leader without a group, no group commits until resumed
+  void resumeLogGroups();
+  ft::AckPolicy getAckPolicy(unsigned long long key);
+  bool shouldCompress(unsigned long long key);
+  void leadLogGroup(std::unique_lock<std::mutex>& lock);
+  void log_ship(); // send queued async log requests
+  void addBackupKeyRange(std::pair<unsigned long long, unsigned long long> keyRange);
+  void removeBackupKeyRange(std::pair<unsigned long long, unsigned long long> keyRange);
+  void setLogEntry(unsigned long long key, unsigned requestInteger, data_t* value, uint64_t seq = 0);
+  void clearLogEntries();
+  int restoreLogHistory(std::string walDir, size_t walSegmentSize);
+  std::string snapshotPath(ft::Server* owner);
+  int loadSnapshot(ft::Server* owner, uint64_t* walSegment);
+  void snapshot_loop(); // periodically call takeSnapshot
 
   /**
    *
@@ -121,15 +386,20 @@ public:
     provider = std::move(src.provider);
     clientPort = std::move(src.clientPort);
     serverPort = std::move(src.serverPort);
+    parallelLogging = std::move(src.parallelLogging);
+    logSlotSize = std::move(src.logSlotSize);
+    logSlotEntries = std::move(src.logSlotEntries);
+    maxValueSize = std::move(src.maxValueSize);
     primaryKeys = std::move(src.primaryKeys);
+    publishPrimaryKeys();
     backupKeys = std::move(src.backupKeys);
+    backupKeyIndex.publish(backupKeys);
     backupServers = std::move(src.backupServers);
     primaryServers = std::move(src.primaryServers);
     originalBackupServers = std::move(src.originalBackupServers);
     originalPrimaryServers = std::move(src.originalPrimaryServers);
     client_listen_thread = std::move(src.client_listen_thread);
-    primary_listen_threads = std::move(src.primary_listen_threads);
-    heartbeat_threads = std::move(src.heartbeat_threads);
+    heartbeat_thread = std::move(src.heartbeat_thread);
     //heartbeat_mr = std::move(src.heartbeat_mr);
     heartbeat_key = std::move(src.heartbeat_key);
     heartbeat_addr = std::move(src.heartbeat_addr);
@@ -196,6 +466,41 @@ public:
    */
   bool addKeyRange(std::pair<unsigned long long, unsigned long long> keyRange);
 
+  /**
+   *
+   * Replace all primary key ranges
+   *
+   * @param keyRanges - vector of min/max key range pairs
+   *
+   */
+  void setKeyRanges(std::vector<std::pair<unsigned long long, unsigned long long>> keyRanges);
+
+  /**
+   *
+   * Write a key range list in the layout discovery clients read,
+   * truncated to what fits in DISCOVERY_SIZE
+   *
+   * @param buf - DISCOVERY_SIZE bytes to write to
+   * @param version - even version of the list
+   * @param ranges - min/max key range pairs
+   *
+   */
+  static void encodeKeyRanges(char* buf, uint64_t version, const std::vector<std::pair<unsigned long long, unsigned long long>>& ranges);
+
+  /**
+   *
+   * Read a key range list written by encodeKeyRanges
+   *
+   * @param buf - DISCOVERY_SIZE bytes to read from
+   * @param ranges - filled with the min/max key range pairs
+   * @param versionOut - set to the version of the list if not null
+   *
+   * @return true if a complete list was read, false if none was
+   * published or it was caught mid-update
+   *
+   */
+  static bool decodeKeyRanges(const char* buf, std::vector<std::pair<unsigned long long, unsigned long long>>* ranges, uint64_t* versionOut = nullptr);
+
   /**
    *
    * Add server who this one is backing up
@@ -282,13 +587,47 @@ public:
    * @param failedBatch - will be populated with any requests that
    *                      were not backed up. This could be due to the backup
    *                      server being unavailable, or the request being invalid.
+   * @param ackPolicy - backups to wait for before returning. By default
+   *                    the policy configured for each key's range.
    *
    * @return 0 on success, KVCG_EUNAVAILABLE if all requests were valid,
    *         but no backup server was available. KVCG_EINVALID if any
    *         request was not valid.
    *
    */
-  int logRequest(std::vector<RequestWrapper<unsigned long long, data_t *>> batch, std::vector<RequestWrapper<unsigned long long, data_t*>>* failedBatch=nullptr);
+  int logRequest(std::vector<RequestWrapper<unsigned long long, data_t *>> batch, std::vector<RequestWrapper<unsigned long long, data_t*>>* failedBatch=nullptr, ft::AckPolicy ackPolicy=ft::ACK_DEFAULT);
+
+  /**
+   *
+   * Log a batch of RequestWrapper transactions to backup servers without
+   * waiting for the writes to complete. The values in batch must stay valid
+   * until callback is called.
+   *
+   * @param batch - batch of backup requests
+   * @param callback - called once the batch is logged with the status
+   *                   logRequest would have returned and the requests
+   *                   that were not backed up. Runs on a logging thread,
+   *                   so it should not block.
+   * @param ackPolicy - backups to wait for before calling back
+   *
+   */
+  void logRequestAsync(std::vector<RequestWrapper<unsigned long long, data_t *>> batch, std::function<void(int, std::vector<RequestWrapper<unsigned long long, data_t *>>&)> callback, ft::AckPolicy ackPolicy=ft::ACK_DEFAULT);
+
+  /**
+   *
+   * Log a batch of RequestWrapper transactions to backup servers without
+   * waiting for the writes to complete. The values in batch must stay valid
+   * until the returned future is ready.
+   *
+   * @param batch - batch of backup requests
+   * @param failedBatch - if not null, populated with any requests that were
+   *                      not backed up before the future is ready
+   * @param ackPolicy - backups to wait for before the future is ready
+   *
+   * @return future holding the status logRequest would have returned
+   *
+   */
+  std::future<int> logRequestAsync(std::vector<RequestWrapper<unsigned long long, data_t *>> batch, std::vector<RequestWrapper<unsigned long long, data_t*>>* failedBatch=nullptr, ft::AckPolicy ackPolicy=ft::ACK_DEFAULT);
 
   /**
    *
@@ -299,6 +638,62 @@ public:
    */
   std::size_t getHash();
 
+  /**
+   *
+   * Ask this server for the key ranges it is currently primary for.
+   * The connection to the server is kept open, repeated queries
+   * read its published range list directly.
+   *
+   * @param ranges - populated with the server's primary key ranges
+   *
+   * @return status. 0 on success, non-zero if the server could not be reached.
+   *
+   */
+  int queryPrimaryRanges(std::vector<std::pair<unsigned long long, unsigned long long>>* ranges);
+
+  /**
+   *
+   * Save log history to snapshot files now. Write-ahead log segments
+   * covered by the snapshot are deleted.
+   *
+   * @return status. 0 on success, non-zero otherwise.
+   *
+   */
+  int takeSnapshot();
+
+  /**
+   *
+   * Write the recent trace events to a binary file: TRACE_MAGIC, then
+   * u64 TRACE_VERSION, u64 event count, and each ft::TraceEvent oldest
+   * first. Tracing is enabled with the traceEvents config option.
+   *
+   * @param filename - file to write
+   *
+   * @return status. 0 on success, non-zero otherwise.
+   *
+   */
+  int dumpTrace(std::string filename) { return trace.dump(filename); }
+
+  /**
+   *
+   * Set the AckPolicy used for keys in each range
+   *
+   * @param policies - key ranges and their policies. Keys in no range use ACK_ALL.
+   *
+   */
+  void setAckPolicies(std::vector<std::pair<std::pair<unsigned long long, unsigned long long>, ft::AckPolicy>> policies);
+
+  /**
+   *
+   * Set the key ranges whose log batches are compressed before they are
+   * written to backups. A batch holding any key in these ranges is
+   * compressed, and sent as is if that does not save space.
+   *
+   * @param ranges - key ranges to compress
+   *
+   */
+  void setCompressRanges(std::vector<std::pair<unsigned long long, unsigned long long>> ranges);
+
 };
 
 #endif //FAULT_TOLERANCE_SERVER_H
@@ -2,6 +2,7 @@
 #define FAULT_TOLERANCE_SHARD_H
 
 #include <vector>
+#include <thread>
 #include <faulttolerance/server.h>
 
 // Forward declare Shard in namespace
@@ -18,10 +19,15 @@ private:
   std::vector<ft::Server*> servers;
   ft::Server* primary;
   std::pair<unsigned long long, unsigned long long> keyRange;
+  // discovery probes still running after discoverPrimary returned
+  std::vector<std::thread> probes;
+
+  void joinProbes();
 
 public:
   // Initialize shard with given key range
   Shard(std::pair<unsigned long long, unsigned long long> kr) { keyRange = kr; }
+  ~Shard();
 
   /**
    *
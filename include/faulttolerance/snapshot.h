@@ -0,0 +1,195 @@
+#ifndef FAULT_TOLERANCE_SNAPSHOT_H
+#define FAULT_TOLERANCE_SNAPSHOT_H
+
+#include <string>
+#include <map>
+#include <vector>
+#include <cstdint>
+
+#include <data_t.hh>
+#include <RequestWrapper.hh>
+
+#define SNAPSHOT_MAGIC "KVCGSNAP"
+#define SNAPSHOT_VERSION 2
+
+// Forward declare LogSnapshot in namespace
+namespace cse498 {
+  namespace faulttolerance {
+    class LogSnapshot;
+  }
+}
+
+namespace ft = cse498::faulttolerance;
+
+/**
+ *
+ * Snapshot of a server's log history in a file that is used in place.
+ *
+ * Layout: a Header, then count Entry records sorted by key, then a heap
+ * holding the values Entry::offset points into. Opening a snapshot only
+ * maps it and checks the header; entries are looked up and values read
+ * straight from the mapping.
+ *
+ * Snapshots are written to <path>.tmp and renamed over path by commit,
+ * so path always holds a complete snapshot.
+ *
+ */
+class ft::LogSnapshot {
+public:
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t count;      // entries in the table
+    uint64_t heapSize;   // bytes of values after the table
+    uint64_t walSegment; // first write-ahead log segment not in the snapshot
+    uint64_t epoch;      // log stream the entries came from
+    uint64_t seq;        // last sequence number of that stream in the snapshot
+  };
+
+  struct Entry {
+    unsigned long long key;
+    uint32_t requestInteger;
+    uint32_t size;   // value size
+    uint64_t offset; // value offset into the heap
+  };
+
+private:
+  char* map = nullptr;
+  size_t mapSize = 0;
+  const Header* header = nullptr;
+  const Entry* table = nullptr;
+  const char* heap = nullptr;
+
+public:
+  LogSnapshot() = default;
+  LogSnapshot(const LogSnapshot&) = delete;
+  LogSnapshot& operator=(const LogSnapshot&) = delete;
+  ~LogSnapshot() { close(); }
+
+  /**
+   *
+   * Build the snapshot file contents for entries in memory. Only copies
+   * memory, so this is the part to do while holding the lock on entries.
+   *
+   * @param entries - log history to capture
+   * @param walSegment - first write-ahead log segment with requests not in entries
+   * @param epoch - epoch of the log stream entries came from
+   * @param seq - last sequence number of that stream applied to entries
+   * @param image - filled with the file contents
+   *
+   */
+  static void capture(const std::map<unsigned long long, RequestWrapper<unsigned long long, data_t*>*>& entries, uint64_t walSegment, uint64_t epoch, uint64_t seq, std::vector<char>* image);
+
+  /**
+   *
+   * Write an image built by capture to <path>.tmp
+   *
+   * @param path - snapshot file
+   * @param image - file contents
+   *
+   * @return status. 0 on success, non-zero otherwise.
+   *
+   */
+  static int writeImage(std::string path, const std::vector<char>& image);
+
+  /**
+   *
+   * Write entries to <path>.tmp, capture then writeImage
+   *
+   * @param path - snapshot file
+   * @param entries - log history to write
+   * @param walSegment - first write-ahead log segment with requests not in entries
+   * @param epoch - epoch of the log stream entries came from
+   * @param seq - last sequence number of that stream applied to entries
+   *
+   * @return status. 0 on success, non-zero otherwise.
+   *
+   */
+  static int write(std::string path, const std::map<unsigned long long, RequestWrapper<unsigned long long, data_t*>*>& entries, uint64_t walSegment, uint64_t epoch = 0, uint64_t seq = 0);
+
+  /**
+   *
+   * Sync <path>.tmp to disk and replace path with it
+   *
+   * @param path - snapshot file passed to write
+   *
+   * @return status. 0 on success, non-zero otherwise.
+   *
+   */
+  static int commit(std::string path);
+
+  /**
+   *
+   * Map a snapshot for reading
+   *
+   * @param path - snapshot file
+   *
+   * @return status. 0 on success, KVCG_EUNAVAILABLE if there is no snapshot,
+   *         non-zero otherwise.
+   *
+   */
+  int open(std::string path);
+
+  /**
+   *
+   * Unmap the snapshot
+   *
+   */
+  void close();
+
+  /**
+   *
+   * Get number of entries in the snapshot
+   *
+   * @return entry count
+   *
+   */
+  uint64_t size() { return header == nullptr ? 0 : header->count; }
+
+  /**
+   *
+   * Get the first write-ahead log segment that must be replayed after the snapshot
+   *
+   * @return segment index
+   *
+   */
+  uint64_t getWalSegment() { return header == nullptr ? 0 : header->walSegment; }
+
+  /**
+   *
+   * Get the log stream epoch and last sequence number the snapshot was taken at
+   *
+   * @return epoch or sequence number, 0 if not recorded
+   *
+   */
+  uint64_t getEpoch() { return header == nullptr ? 0 : header->epoch; }
+  uint64_t getSeq() { return header == nullptr ? 0 : header->seq; }
+
+  const Entry* begin() { return table; }
+  const Entry* end() { return table + size(); }
+
+  /**
+   *
+   * Find the entry for a key
+   *
+   * @param key - key to look up
+   *
+   * @return entry, or nullptr if key is not in the snapshot
+   *
+   */
+  const Entry* find(unsigned long long key);
+
+  /**
+   *
+   * Get the value of an entry
+   *
+   * @param entry - entry in this snapshot
+   *
+   * @return pointer to entry->size bytes, valid until close
+   *
+   */
+  const char* value(const Entry* entry) { return heap + entry->offset; }
+};
+
+#endif // FAULT_TOLERANCE_SNAPSHOT_H
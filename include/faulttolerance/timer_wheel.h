@@ -0,0 +1,106 @@
+#ifndef FAULT_TOLERANCE_TIMER_WHEEL_H
+#define FAULT_TOLERANCE_TIMER_WHEEL_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Default number of slots around the wheel
+#define TIMER_WHEEL_SLOTS 256
+
+// Forward declare TimerWheel in namespace
+namespace cse498 {
+  namespace faulttolerance {
+    class TimerWheel;
+  }
+}
+
+namespace ft = cse498::faulttolerance;
+
+/**
+ *
+ * Hashed timer wheel driving many timers from a single thread.
+ *
+ * The owner calls tick every getTickMs milliseconds. A timer lands in the
+ * slot it expires in and carries how many more turns of the wheel it has
+ * to wait, so scheduling and expiring are O(1) no matter how many timers
+ * are pending. Timers are identified by a caller chosen id.
+ *
+ * Not thread safe, the owner serializes access.
+ *
+ */
+class ft::TimerWheel {
+private:
+  struct Timer {
+    uint64_t id;
+    uint64_t rounds; // full turns left before it expires
+  };
+
+  std::vector<std::vector<Timer>> slots;
+  size_t current = 0;
+  unsigned int tickMs;
+  size_t count = 0;
+
+public:
+  TimerWheel(unsigned int tickMs = 1, size_t numSlots = TIMER_WHEEL_SLOTS);
+
+  /**
+   *
+   * Set the tick length. Only call while no timers are pending.
+   *
+   * @param tickMs - milliseconds per tick, at least 1
+   *
+   */
+  void setTickMs(unsigned int tickMs) { this->tickMs = tickMs == 0 ? 1 : tickMs; }
+
+  /**
+   *
+   * Get the tick length
+   *
+   * @return milliseconds per tick
+   *
+   */
+  unsigned int getTickMs() { return tickMs; }
+
+  /**
+   *
+   * Get number of pending timers
+   *
+   * @return timer count
+   *
+   */
+  size_t size() { return count; }
+
+  /**
+   *
+   * Start a timer. It expires on the first tick at least delayMs from
+   * now, rounded up to whole ticks and never sooner than the next one.
+   *
+   * @param id - returned by tick when the timer expires
+   * @param delayMs - milliseconds until it expires
+   *
+   */
+  void schedule(uint64_t id, unsigned int delayMs);
+
+  /**
+   *
+   * Stop every pending timer with id
+   *
+   * @param id - timer to stop
+   *
+   * @return true if a timer was stopped
+   *
+   */
+  bool cancel(uint64_t id);
+
+  /**
+   *
+   * Advance the wheel by one tick
+   *
+   * @param expired - ids of timers expiring on this tick are appended here
+   *
+   */
+  void tick(std::vector<uint64_t>& expired);
+};
+
+#endif // FAULT_TOLERANCE_TIMER_WHEEL_H
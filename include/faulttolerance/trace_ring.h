@@ -0,0 +1,123 @@
+#ifndef FAULT_TOLERANCE_TRACE_RING_H
+#define FAULT_TOLERANCE_TRACE_RING_H
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Trace file: magic, version, event count, then the events
+#define TRACE_MAGIC "KVCGTRCE"
+#define TRACE_VERSION 1
+
+// Forward declare TraceRing in namespace
+namespace cse498 {
+  namespace faulttolerance {
+    class TraceRing;
+
+    // What a trace event records, key and arg depend on it
+    enum TraceEventType {
+      TRACE_LOG_SEND = 1,  // request added to a batch, key, arg log sequence number
+      TRACE_SLOT_WRITE,    // batch written to a backup, key ring slot index, arg bytes
+      TRACE_LOG_APPLY,     // request applied from a primary, key, arg value bytes
+      TRACE_GROUP_COMMIT,  // log group done, key caller requests, arg requests in them
+      TRACE_HEARTBEAT      // heartbeat written to a backup, key heartbeat count, arg ms since last log write
+    };
+
+    struct TraceEvent {
+      uint64_t timeNs; // steady clock
+      uint64_t type;
+      uint64_t key;
+      uint64_t arg;
+    };
+  }
+}
+
+namespace ft = cse498::faulttolerance;
+
+/**
+ *
+ * Fixed size ring of the most recent binary trace events.
+ *
+ * Any thread records with one atomic increment and a few relaxed
+ * stores, no locks and no formatting. Each slot carries the number of
+ * the event in it, cleared while the event is being written, so a dump
+ * running alongside writers skips events it catches half written.
+ *
+ */
+class ft::TraceRing {
+private:
+  struct Slot {
+    std::atomic<uint64_t> seq{0}; // event number + 1, 0 while empty or being written
+    std::atomic<uint64_t> words[4];
+  };
+
+  std::unique_ptr<Slot[]> slots;
+  size_t mask = 0;
+  std::atomic<uint64_t> head{0};
+
+public:
+  TraceRing() = default;
+  TraceRing(const TraceRing&) = delete;
+  TraceRing& operator=(const TraceRing&) = delete;
+
+  /**
+   *
+   * Size the ring, dropping recorded events. Only call while nothing records.
+   *
+   * @param events - events kept, rounded up to a power of two. 0 disables tracing.
+   *
+   */
+  void resize(size_t events);
+
+  bool enabled() { return mask != 0; }
+
+  /**
+   *
+   * Record an event, overwriting the oldest once the ring is full
+   *
+   * @param type - TraceEventType
+   * @param key - event key
+   * @param arg - event argument
+   *
+   */
+  void record(uint64_t type, uint64_t key, uint64_t arg) {
+    if (mask == 0) return;
+    uint64_t n = head.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot = slots[n & mask];
+    uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+    slot.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.words[0].store(now, std::memory_order_relaxed);
+    slot.words[1].store(type, std::memory_order_relaxed);
+    slot.words[2].store(key, std::memory_order_relaxed);
+    slot.words[3].store(arg, std::memory_order_relaxed);
+    slot.seq.store(n + 1, std::memory_order_release);
+  }
+
+  /**
+   *
+   * Copy out the events in the ring
+   *
+   * @param events - filled with the events, oldest first
+   *
+   */
+  void snapshot(std::vector<ft::TraceEvent>* events);
+
+  /**
+   *
+   * Write the events in the ring to a binary trace file
+   *
+   * @param filename - file to write
+   *
+   * @return status. 0 on success, non-zero otherwise.
+   *
+   */
+  int dump(std::string filename);
+};
+
+#endif // FAULT_TOLERANCE_TRACE_RING_H
@@ -0,0 +1,141 @@
+#ifndef FAULT_TOLERANCE_WAL_H
+#define FAULT_TOLERANCE_WAL_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <functional>
+#include <cstdint>
+
+#include <data_t.hh>
+#include <RequestWrapper.hh>
+
+// Default size each write-ahead log segment file is preallocated to
+#define WAL_SEGMENT_SIZE (64*1024*1024)
+// Record header: payload length, payload crc32
+#define WAL_RECORD_HDR_SIZE (2*sizeof(uint32_t))
+// Record payload before the value: key, requestInteger, value size
+#define WAL_RECORD_FIXED_SIZE (sizeof(unsigned long long) + 2*sizeof(uint32_t))
+
+// Forward declare WriteAheadLog in namespace
+namespace cse498 {
+  namespace faulttolerance {
+    class WriteAheadLog;
+  }
+}
+
+namespace ft = cse498::faulttolerance;
+
+/**
+ *
+ * On-disk write-ahead log of requests a primary has logged.
+ *
+ * Records are appended to segment files named <name>-<index>.wal that are
+ * preallocated to a fixed size, so appending never changes file metadata
+ * and the single fdatasync per append stays cheap. The unused tail of a
+ * segment reads as zeros, which ends replay. Each record carries a crc32
+ * so a torn write at the end of the log is detected and dropped.
+ *
+ * Callers append a whole group of requests at once, which is the unit
+ * of durability.
+ *
+ */
+class ft::WriteAheadLog {
+private:
+  std::mutex lock;
+  std::string dir;
+  std::string name;
+  size_t segmentSize = WAL_SEGMENT_SIZE;
+
+  int fd = -1;
+  uint64_t segment = 0; // index of the segment being appended to
+  size_t offset = 0;    // next write position in segment
+
+  std::vector<char> buf; // records of the group being appended
+
+  std::string segmentPath(uint64_t index);
+  std::vector<uint64_t> listSegments();
+  int openSegment(uint64_t index);
+  static uint32_t crc32(const char* data, size_t len);
+
+public:
+  WriteAheadLog() = default;
+  WriteAheadLog(const WriteAheadLog&) = delete;
+  WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+  ~WriteAheadLog() { close(); }
+
+  /**
+   *
+   * Open the log, creating dir if needed. Appends go to a new segment
+   * after any that already exist.
+   *
+   * @param dir - directory holding the segment files
+   * @param name - prefix of segment files, unique per server
+   * @param segmentSize - bytes to preallocate per segment
+   *
+   * @return status. 0 on success, non-zero otherwise.
+   *
+   */
+  int open(std::string dir, std::string name, size_t segmentSize = WAL_SEGMENT_SIZE);
+
+  /**
+   *
+   * Close the log
+   *
+   */
+  void close();
+
+  /**
+   *
+   * Check if the log has been opened
+   *
+   * @return true if open
+   *
+   */
+  bool isOpen() { return fd >= 0; }
+
+  /**
+   *
+   * Append the INSERT and REMOVE requests in batch, then sync them to disk
+   *
+   * @param batch - requests to append
+   *
+   * @return status. 0 once all requests are durable, non-zero otherwise.
+   *
+   */
+  int append(const std::vector<RequestWrapper<unsigned long long, data_t *>>& batch);
+
+  /**
+   *
+   * Read back every record in the log, oldest first. Call before append.
+   *
+   * @param apply - called with each request. The value is only valid during the call.
+   * @param fromSegment - skip segments before this one
+   *
+   * @return status. 0 on success, non-zero if a segment could not be read.
+   *
+   */
+  int replay(std::function<void(RequestWrapper<unsigned long long, data_t *>&)> apply, uint64_t fromSegment = 0);
+
+  /**
+   *
+   * Start appending to a new segment
+   *
+   * @param index - set to the index of the new segment
+   *
+   * @return status. 0 on success, non-zero otherwise.
+   *
+   */
+  int rollover(uint64_t* index);
+
+  /**
+   *
+   * Delete segments that are no longer needed, e.g. covered by a snapshot
+   *
+   * @param index - delete every segment before this one
+   *
+   */
+  void removeSegmentsBefore(uint64_t index);
+};
+
+#endif // FAULT_TOLERANCE_WAL_H
@@ -12,6 +12,8 @@
 #include <thread>
 #include <string.h>
 #include <sstream>
+#include <algorithm>
+#include <map>
 #include <boost/asio/ip/host_name.hpp>
 #include <data_t.hh>
 #include <RequestTypes.hh>
@@ -51,18 +53,107 @@ int ft::Client::initialize(std::string cfg_file) {
         }
     }
 
+    buildShardIndex();
+
 exit:
     return status;
 }
 
+void ft::Client::buildShardIndex() {
+    sortedShards = shardList;
+    std::sort(sortedShards.begin(), sortedShards.end(), [](ft::Shard* a, ft::Shard* b) {
+        return a->getLowerBound() < b->getLowerBound();
+    });
+    shardBounds.assign(sortedShards.size()+1, 0);
+    shardRank.assign(sortedShards.size()+1, 0);
+    fillShardIndex(1, 0);
+    LOG(DEBUG4) << "Indexed " << sortedShards.size() << " shards";
+}
+
+size_t ft::Client::fillShardIndex(size_t node, size_t next) {
+    // In-order walk of the implicit tree assigns sorted shards to nodes
+    if (node < shardBounds.size()) {
+        next = fillShardIndex(2*node, next);
+        shardBounds[node] = sortedShards[next]->getLowerBound();
+        shardRank[node] = next++;
+        next = fillShardIndex(2*node+1, next);
+    }
+    return next;
+}
+
 ft::Shard* ft::Client::getShard(unsigned long long key) {
-    LOG(DEBUG4) << "iterating through shards: " << shardList.size();
-    for (auto shard : this->shardList) {
-        LOG(DEBUG4) << "checking shard [" << shard->getLowerBound() << ", " << shard->getUpperBound() << "]";
-        if (shard->containsKey(key)) {
-            LOG(DEBUG4) << "Key is within the range";
-            return shard;
+    size_t n = sortedShards.size();
+
+    // Descend to the first lower bound greater than key
+    size_t node = 1;
+    while (node <= n) {
+        node = 2*node + (shardBounds[node] <= key);
+    }
+    node >>= __builtin_ffsll(~node);
+
+    // The shard before it is the only one that could contain key
+    size_t rank = (node == 0) ? n : shardRank[node];
+    if (rank == 0) {
+        return nullptr;
+    }
+    ft::Shard* shard = sortedShards[rank-1];
+    return shard->containsKey(key) ? shard : nullptr;
+}
+
+std::unordered_map<ft::Shard*, std::vector<unsigned long long>> ft::Client::getShards(const std::vector<unsigned long long>& keys) {
+    std::unordered_map<ft::Shard*, std::vector<unsigned long long>> grouped;
+    ft::Shard* shard = nullptr;
+    std::vector<unsigned long long>* group = nullptr;
+
+    for (auto key : keys) {
+        // Batches are usually clustered, only search when leaving the last shard
+        if (shard == nullptr || !shard->containsKey(key)) {
+            shard = getShard(key);
+            group = &grouped[shard];
         }
+        group->push_back(key);
     }
-    return nullptr;
+    return grouped;
+}
+
+int ft::Client::rediscoverShards() {
+    LOG(INFO) << "Rediscovering primaries for " << shardList.size() << " shards";
+
+    // Query all servers concurrently, each one once
+    std::vector<std::vector<std::pair<unsigned long long, unsigned long long>>> ranges(serverList.size());
+    std::vector<std::thread> queries;
+    for (int i=0; i < serverList.size(); i++) {
+        queries.emplace_back([this, &ranges, i]() {
+            serverList[i]->queryPrimaryRanges(&ranges[i]);
+        });
+    }
+    for (auto &t : queries) {
+        t.join();
+    }
+
+    return assignPrimaries(ranges);
+}
+
+int ft::Client::assignPrimaries(const std::vector<std::vector<std::pair<unsigned long long, unsigned long long>>>& ranges) {
+    int status = KVCG_ESUCCESS;
+
+    // Resolve every shard from the combined range lists
+    std::map<std::pair<unsigned long long, unsigned long long>, ft::Server*> owners;
+    for (int i=0; i < serverList.size() && i < ranges.size(); i++) {
+        for (auto kr : ranges[i]) {
+            owners[kr] = serverList[i];
+        }
+    }
+    for (auto shard : shardList) {
+        auto owner = owners.find({shard->getLowerBound(), shard->getUpperBound()});
+        if (owner == owners.end()) {
+            LOG(ERROR) << "Could not find primary server for shard [" << shard->getLowerBound() << ", " << shard->getUpperBound() << "]";
+            status = KVCG_EUNKNOWN;
+            continue;
+        }
+        LOG(DEBUG) << "Shard [" << shard->getLowerBound() << ", " << shard->getUpperBound() << "] primary is " << owner->second->getName();
+        shard->setPrimary(owner->second);
+    }
+
+    return status;
 }
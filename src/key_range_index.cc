@@ -0,0 +1,51 @@
+/****************************************************
+ *
+ * Key Range Index Implementation
+ *
+ ****************************************************/
+#include <faulttolerance/key_range_index.h>
+
+#include <algorithm>
+
+namespace ft = cse498::faulttolerance;
+
+ft::KeyRangeIndex::KeyRangeIndex() {
+    snapshots.emplace_back(new RangeList());
+    current.store(snapshots.back().get(), std::memory_order_release);
+}
+
+void ft::KeyRangeIndex::publish(const std::vector<std::pair<unsigned long long, unsigned long long>>& ranges) {
+    RangeList* merged = new RangeList(ranges);
+    std::sort(merged->begin(), merged->end());
+
+    // Merge overlapping and adjacent ranges
+    size_t out = 0;
+    for (size_t i=0; i < merged->size(); i++) {
+        auto kr = merged->at(i);
+        if (out > 0 && (merged->at(out-1).second == ~0ULL || kr.first <= merged->at(out-1).second + 1)) {
+            merged->at(out-1).second = std::max(merged->at(out-1).second, kr.second);
+        } else {
+            merged->at(out++) = kr;
+        }
+    }
+    merged->resize(out);
+
+    std::unique_lock<std::mutex> lock(publishLock);
+    snapshots.emplace_back(merged);
+    current.store(merged, std::memory_order_release);
+}
+
+bool ft::KeyRangeIndex::contains(unsigned long long key) const {
+    const RangeList* ranges = current.load(std::memory_order_acquire);
+
+    // Find the last range starting at or below key
+    auto it = std::upper_bound(ranges->begin(), ranges->end(), key,
+        [](unsigned long long k, const std::pair<unsigned long long, unsigned long long>& kr) {
+            return k < kr.first;
+        });
+    if (it == ranges->begin()) {
+        return false;
+    }
+    --it;
+    return key <= it->second;
+}
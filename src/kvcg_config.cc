@@ -19,10 +19,28 @@
 namespace pt = boost::property_tree;
 namespace ft = cse498::faulttolerance;
 
+static int parse_ack_policy(std::string policy_str, ft::AckPolicy* policy) {
+    if (policy_str == "all") {
+        *policy = ft::ACK_ALL;
+    } else if (policy_str == "quorum") {
+        *policy = ft::ACK_QUORUM;
+    } else if (policy_str == "one") {
+        *policy = ft::ACK_ONE;
+    } else if (policy_str == "async") {
+        *policy = ft::ACK_ASYNC;
+    } else {
+        LOG(ERROR) << "Invalid ackPolicy (" << policy_str << "). Must be 'all', 'quorum', 'one' or 'async'";
+        return KVCG_EBADCONFIG;
+    }
+    return KVCG_ESUCCESS;
+}
+
 int KVCGConfig::parse_json_file(std::string filename) {
     int status = KVCG_ESUCCESS;
     int backupcnt = 0;
     bool hasKeys = false;
+    std::string defaultAckPolicy;
+    bool defaultCompress;
     LOG(DEBUG) << "Opening file: " << filename;
 
     pt::ptree root;
@@ -45,6 +63,55 @@ int KVCGConfig::parse_json_file(std::string filename) {
 
         serverPort = root.get<int>("serverPort", 8080);
         clientPort = root.get<int>("clientPort", 8081);
+        parallelLogging = root.get<bool>("parallelLogging", true);
+        defaultAckPolicy = root.get<std::string>("ackPolicy", "all");
+        defaultCompress = root.get<bool>("compress", false);
+        logSlotSize = root.get<size_t>("logSlotSize", MAX_LOG_SIZE);
+        if (logSlotSize < LOG_SLOT_MIN_SIZE || logSlotSize > LOG_SLOT_MAX_SIZE) {
+            LOG(ERROR) << "Invalid logSlotSize (" << logSlotSize << "). Must be " << LOG_SLOT_MIN_SIZE << " to " << LOG_SLOT_MAX_SIZE << " bytes";
+            status = KVCG_EBADCONFIG;
+            goto exit;
+        }
+        {
+            long long entries = root.get<long long>("logSlotEntries", 0);
+            if (entries < 0 || entries > UINT32_MAX) {
+                LOG(ERROR) << "Invalid logSlotEntries (" << entries << "). Must be positive, or 0 for no limit";
+                status = KVCG_EBADCONFIG;
+                goto exit;
+            }
+            logSlotEntries = entries;
+        }
+        maxValueSize = root.get<size_t>("maxValueSize", MAX_VALUE_SIZE);
+        if (maxValueSize == 0 || maxValueSize > UINT32_MAX) {
+            LOG(ERROR) << "Invalid maxValueSize (" << maxValueSize << "). Must be 1 to " << UINT32_MAX << " bytes";
+            status = KVCG_EBADCONFIG;
+            goto exit;
+        }
+        walDir = root.get<std::string>("walDir", "");
+        walSegmentSize = root.get<size_t>("walSegmentSize", WAL_SEGMENT_SIZE);
+        snapshotDir = root.get<std::string>("snapshotDir", "");
+        snapshotIntervalMs = root.get<int>("snapshotIntervalMs", 60000);
+        heartbeatIntervalMs = root.get<int>("heartbeatIntervalMs", HB_INTERVAL_MS);
+        heartbeatTimeoutMs = root.get<int>("heartbeatTimeoutMs", HB_TIMEOUT_MS);
+        if (heartbeatIntervalMs <= 0 || heartbeatTimeoutMs <= heartbeatIntervalMs) {
+            LOG(ERROR) << "Invalid heartbeat interval (" << heartbeatIntervalMs << "ms) and timeout (" << heartbeatTimeoutMs << "ms). Timeout must be longer than interval";
+            status = KVCG_EBADCONFIG;
+            goto exit;
+        }
+        pollerThreads = root.get<int>("pollerThreads", 1);
+        pollerCpu = root.get<int>("pollerCpu", -1);
+        traceEvents = root.get<size_t>("traceEvents", 0);
+        if (pollerThreads < 1) {
+            LOG(ERROR) << "Invalid pollerThreads (" << pollerThreads << "). Must be at least 1";
+            status = KVCG_EBADCONFIG;
+            goto exit;
+        }
+        phiThreshold = root.get<double>("phiThreshold", PHI_THRESHOLD);
+        if (phiThreshold < 0) {
+            LOG(ERROR) << "Invalid phiThreshold (" << phiThreshold << "). Must be positive, or 0 to disable";
+            status = KVCG_EBADCONFIG;
+            goto exit;
+        }
 
         for (pt::ptree::value_type &server : root.get_child("servers")) {
             std::string server_name = server.second.get<std::string>("name");
@@ -105,6 +172,13 @@ int KVCGConfig::parse_json_file(std::string filename) {
 
             if (hasKeys) {
               primServer->addKeyRange(keyRange);
+              ft::AckPolicy ackPolicy;
+              if (status = parse_ack_policy(server.second.get<std::string>("ackPolicy", defaultAckPolicy), &ackPolicy))
+                  goto exit;
+              ackPolicies.push_back({keyRange, ackPolicy});
+              if (server.second.get<bool>("compress", defaultCompress)) {
+                  compressRanges.push_back(keyRange);
+              }
               BOOST_FOREACH(pt::ptree::value_type &backup, server.second.get_child("backups")) {
                 std::string backupName = backup.second.data();
                 if (backupName == server_name) {
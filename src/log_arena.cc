@@ -0,0 +1,91 @@
+/****************************************************
+ *
+ * Log History Arena Implementation
+ *
+ ****************************************************/
+#include <faulttolerance/log_arena.h>
+
+#include <new>
+
+namespace ft = cse498::faulttolerance;
+
+ft::LogArena::~LogArena() {
+    for (auto slab : slabs) {
+        delete[] slab;
+    }
+}
+
+size_t ft::LogArena::classIndex(size_t size) {
+    size_t idx = 0;
+    size_t cls = LOG_ARENA_MIN_CLASS;
+    while (cls < size) {
+        cls <<= 1;
+        idx++;
+    }
+    return idx;
+}
+
+size_t ft::LogArena::classSize(size_t size) {
+    return (size_t)LOG_ARENA_MIN_CLASS << classIndex(size);
+}
+
+char* ft::LogArena::carve(size_t size) {
+    if (size > LOG_ARENA_SLAB_SIZE) {
+        // Oversized class, give it a slab of its own
+        char* block = new char[size];
+        slabs.push_back(block);
+        return block;
+    }
+    if (slabLeft < size) {
+        // Any tail of the previous slab is left unused
+        slabCur = new char[LOG_ARENA_SLAB_SIZE];
+        slabLeft = LOG_ARENA_SLAB_SIZE;
+        slabs.push_back(slabCur);
+    }
+    char* block = slabCur;
+    slabCur += size;
+    slabLeft -= size;
+    return block;
+}
+
+char* ft::LogArena::allocate(size_t size) {
+    size_t idx = classIndex(size);
+    FreeBlock* block = freeLists[idx];
+    if (block != nullptr) {
+        freeLists[idx] = block->next;
+        return (char*)block;
+    }
+    return carve((size_t)LOG_ARENA_MIN_CLASS << idx);
+}
+
+void ft::LogArena::release(char* p, size_t size) {
+    if (p == nullptr) return;
+    size_t idx = classIndex(size);
+    FreeBlock* block = (FreeBlock*)p;
+    block->next = freeLists[idx];
+    freeLists[idx] = block;
+}
+
+RequestWrapper<unsigned long long, data_t*>* ft::LogArena::allocEntry(unsigned long long key, size_t size) {
+    Entry* block = new (allocate(sizeof(Entry))) Entry();
+    auto entry = &block->req;
+    entry->key = key;
+    entry->value = new (allocate(sizeof(data_t))) data_t();
+    entry->value->data = allocate(size);
+    entry->value->size = size;
+    return entry;
+}
+
+void ft::LogArena::resizeEntry(RequestWrapper<unsigned long long, data_t*>* entry, size_t size) {
+    if (classIndex(size) != classIndex(entry->value->size)) {
+        release(entry->value->data, entry->value->size);
+        entry->value->data = allocate(size);
+    }
+    entry->value->size = size;
+}
+
+void ft::LogArena::releaseEntry(RequestWrapper<unsigned long long, data_t*>* entry) {
+    release(entry->value->data, entry->value->size);
+    release((char*)entry->value, sizeof(data_t));
+    release((char*)entry, sizeof(Entry));
+}
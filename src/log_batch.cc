@@ -0,0 +1,235 @@
+/****************************************************
+ *
+ * Log Batch Wire Format Implementation
+ *
+ ****************************************************/
+#include <faulttolerance/log_batch.h>
+#include <faulttolerance/lz.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include <kvcg_errors.h>
+#include <RequestTypes.hh>
+
+namespace ft = cse498::faulttolerance;
+
+#define TYPE_INSERT 0
+#define TYPE_REMOVE 1
+#define TYPE_OTHER 2
+#define TYPE_CHUNK 3
+#define TYPE_BITS 2
+
+static size_t putVarint(char* buf, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        buf[n++] = (char)(v | 0x80);
+        v >>= 7;
+    }
+    buf[n++] = (char)v;
+    return n;
+}
+
+static inline uint64_t zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static bool getVarint(const char* buf, size_t len, size_t* pos, uint64_t* v) {
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64 && *pos < len; shift += 7) {
+        uint8_t byte = buf[(*pos)++];
+        result |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *v = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ft::LogBatchWriter::reset() {
+    len = LOG_BATCH_HDR_SIZE;
+    count = 0;
+    prevKey = 0;
+    prevSeq = baseSeq;
+    seq = 0;
+    compressed = false;
+}
+
+bool ft::LogBatchWriter::append(const RequestWrapper<unsigned long long, data_t *>& req, uint64_t seq) {
+    uint64_t valueSize = (req.value == nullptr) ? 0 : req.value->size;
+    char hdr[4*LOG_BATCH_MAX_VARINT];
+    size_t n = 0;
+    // zigzag so keys going down are as cheap as keys going up
+    n += putVarint(hdr + n, zigzag((int64_t)(req.key - prevKey)));
+    n += putVarint(hdr + n, zigzag((int64_t)(seq - prevSeq)));
+    uint64_t type = (req.requestInteger == REQUEST_INSERT) ? TYPE_INSERT :
+                    (req.requestInteger == REQUEST_REMOVE) ? TYPE_REMOVE : TYPE_OTHER;
+    n += putVarint(hdr + n, (valueSize << TYPE_BITS) | type);
+    if (type == TYPE_OTHER) {
+        n += putVarint(hdr + n, req.requestInteger);
+    }
+    if (len + n + valueSize > capacity || (maxEntries > 0 && count >= maxEntries)) {
+        return false;
+    }
+
+    memcpy(buf + len, hdr, n);
+    len += n;
+    if (valueSize > 0) {
+        memcpy(buf + len, req.value->data, valueSize);
+        len += valueSize;
+    }
+    prevKey = req.key;
+    prevSeq = seq;
+    this->seq = seq;
+    count++;
+    return true;
+}
+
+size_t ft::LogBatchWriter::appendChunk(const RequestWrapper<unsigned long long, data_t *>& req, size_t offset, uint64_t seq) {
+    uint64_t valueSize = req.value->size;
+    char hdr[6*LOG_BATCH_MAX_VARINT];
+    auto putHeader = [&](uint64_t chunkSize) {
+        size_t n = 0;
+        n += putVarint(hdr + n, zigzag((int64_t)(req.key - prevKey)));
+        n += putVarint(hdr + n, zigzag((int64_t)(seq - prevSeq)));
+        n += putVarint(hdr + n, (chunkSize << TYPE_BITS) | TYPE_CHUNK);
+        n += putVarint(hdr + n, req.requestInteger);
+        n += putVarint(hdr + n, valueSize);
+        n += putVarint(hdr + n, offset);
+        return n;
+    };
+    if (offset >= valueSize || (maxEntries > 0 && count >= maxEntries)) {
+        return 0;
+    }
+
+    // Size the header for the rest of the value, a shorter chunk's is no longer
+    size_t n = putHeader(valueSize - offset);
+    if (len + n >= capacity) {
+        return 0;
+    }
+    uint64_t chunkSize = std::min<uint64_t>(valueSize - offset, capacity - len - n);
+    n = putHeader(chunkSize);
+
+    memcpy(buf + len, hdr, n);
+    len += n;
+    memcpy(buf + len, req.value->data + offset, chunkSize);
+    len += chunkSize;
+    prevKey = req.key;
+    prevSeq = seq;
+    if (offset + chunkSize == valueSize) {
+        this->seq = seq;
+    }
+    count++;
+    return chunkSize;
+}
+
+size_t ft::LogBatchWriter::finish(char* scratch /* DEFAULT nullptr */) {
+    uint16_t flags = 0;
+    uint32_t payload = len - LOG_BATCH_HDR_SIZE;
+    compressed = false;
+    if (scratch != nullptr && payload >= LOG_BATCH_COMPRESS_MIN) {
+        // only keep it if it saves at least an eighth
+        size_t limit = payload - payload / 8;
+        size_t clen = ft::Lz::compress(buf + LOG_BATCH_HDR_SIZE, payload,
+                                       scratch + sizeof(uint32_t), limit - sizeof(uint32_t));
+        if (clen > 0) {
+            memcpy(scratch, &payload, sizeof(uint32_t));
+            payload = sizeof(uint32_t) + clen;
+            memcpy(buf + LOG_BATCH_HDR_SIZE, scratch, payload);
+            len = LOG_BATCH_HDR_SIZE + payload;
+            flags |= LOG_BATCH_COMPRESSED;
+            compressed = true;
+        }
+    }
+    buf[0] = 'l'; // packet type - 'l'=log
+    buf[1] = LOG_BATCH_VERSION;
+    memcpy(buf + 2, &flags, sizeof(uint16_t));
+    memcpy(buf + 4, &count, sizeof(uint32_t));
+    memcpy(buf + 8, &payload, sizeof(uint32_t));
+    memcpy(buf + 12, &seq, sizeof(uint64_t));
+    memcpy(buf + 20, &baseSeq, sizeof(uint64_t));
+    return len;
+}
+
+int ft::LogBatchReader::open(const char* buf, size_t size, char* scratch /* DEFAULT nullptr */, size_t scratchSize /* DEFAULT 0 */) {
+    uint32_t payload, rawPayload;
+    size_t rawLen;
+    if (size < LOG_BATCH_HDR_SIZE || buf[0] != 'l' || buf[1] != LOG_BATCH_VERSION) {
+        return KVCG_EINVALID;
+    }
+    memcpy(&flags, buf + 2, sizeof(uint16_t));
+    memcpy(&count, buf + 4, sizeof(uint32_t));
+    memcpy(&payload, buf + 8, sizeof(uint32_t));
+    memcpy(&seq, buf + 12, sizeof(uint64_t));
+    memcpy(&baseSeq, buf + 20, sizeof(uint64_t));
+    if (payload > size - LOG_BATCH_HDR_SIZE || (flags & ~LOG_BATCH_KNOWN_FLAGS)) {
+        return KVCG_EINVALID;
+    }
+    if (!(flags & LOG_BATCH_COMPRESSED)) {
+        this->buf = buf;
+        len = LOG_BATCH_HDR_SIZE + payload;
+        pos = LOG_BATCH_HDR_SIZE;
+    } else {
+        if (scratch == nullptr || payload < sizeof(uint32_t)) {
+            return KVCG_EINVALID;
+        }
+        memcpy(&rawPayload, buf + LOG_BATCH_HDR_SIZE, sizeof(uint32_t));
+        if (rawPayload > scratchSize ||
+            ft::Lz::decompress(buf + LOG_BATCH_HDR_SIZE + sizeof(uint32_t), payload - sizeof(uint32_t),
+                               scratch, rawPayload, &rawLen) != KVCG_ESUCCESS ||
+            rawLen != rawPayload) {
+            return KVCG_EINVALID;
+        }
+        this->buf = scratch;
+        len = rawLen;
+        pos = 0;
+    }
+    read = 0;
+    prevKey = 0;
+    entrySeq = baseSeq;
+    chunk = false;
+    return KVCG_ESUCCESS;
+}
+
+bool ft::LogBatchReader::next(RequestWrapper<unsigned long long, data_t *>* req) {
+    uint64_t keyDelta, seqDelta, lenType, requestInteger;
+    if (read == count) {
+        return false;
+    }
+    if (!getVarint(buf, len, &pos, &keyDelta) || !getVarint(buf, len, &pos, &seqDelta) ||
+        !getVarint(buf, len, &pos, &lenType)) {
+        return false;
+    }
+    uint64_t type = lenType & ((1 << TYPE_BITS) - 1);
+    uint64_t valueSize = lenType >> TYPE_BITS;
+    if (type == TYPE_INSERT) {
+        requestInteger = REQUEST_INSERT;
+    } else if (type == TYPE_REMOVE) {
+        requestInteger = REQUEST_REMOVE;
+    } else if (!getVarint(buf, len, &pos, &requestInteger)) {
+        return false;
+    }
+    chunk = (type == TYPE_CHUNK);
+    if (chunk && (!getVarint(buf, len, &pos, &chunkTotal) || !getVarint(buf, len, &pos, &chunkOffset) ||
+                  chunkOffset > chunkTotal || valueSize > chunkTotal - chunkOffset)) {
+        return false;
+    }
+    if (valueSize > len - pos) {
+        return false;
+    }
+
+    req->key = prevKey + unzigzag(keyDelta);
+    entrySeq += unzigzag(seqDelta);
+    req->requestInteger = requestInteger;
+    req->value->size = valueSize;
+    req->value->data = (char*)buf + pos;
+    pos += valueSize;
+    prevKey = req->key;
+    read++;
+    return true;
+}
@@ -0,0 +1,162 @@
+/****************************************************
+ *
+ * LZ Block Codec Implementation
+ *
+ ****************************************************/
+#include <faulttolerance/lz.h>
+
+#include <cstring>
+
+#include <kvcg_errors.h>
+
+namespace ft = cse498::faulttolerance;
+
+// Matches never start in the last bytes of a block, keeps the
+// match finder's 4-byte reads inside src
+#define LZ_LAST_LITERALS 5
+#define LZ_MIN_BLOCK 13
+
+static inline uint32_t read32(const char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(uint32_t));
+    return v;
+}
+
+static inline uint32_t hash32(uint32_t v) {
+    return (v * 2654435761U) >> (32 - LZ_HASH_LOG);
+}
+
+// Write the length continuation bytes of a nibble that reached 15
+static inline bool putLength(char*& op, const char* end, size_t n) {
+    while (n >= 255) {
+        if (op >= end) return false;
+        *op++ = (char)255;
+        n -= 255;
+    }
+    if (op >= end) return false;
+    *op++ = (char)n;
+    return true;
+}
+
+static bool putSequence(char*& op, const char* end, const char* literals, size_t numLiterals, size_t offset, size_t matchLen) {
+    if (op >= end) return false;
+    char* token = op++;
+    uint8_t t = (numLiterals >= 15 ? 15 : numLiterals) << 4;
+    if (numLiterals >= 15 && !putLength(op, end, numLiterals - 15)) return false;
+    if ((size_t)(end - op) < numLiterals) return false;
+    if (numLiterals > 0) {
+        memcpy(op, literals, numLiterals);
+        op += numLiterals;
+    }
+
+    if (matchLen > 0) {
+        if (end - op < 2) return false;
+        *op++ = (char)(offset & 0xFF);
+        *op++ = (char)(offset >> 8);
+        size_t m = matchLen - LZ_MIN_MATCH;
+        t |= (m >= 15 ? 15 : m);
+        if (m >= 15 && !putLength(op, end, m - 15)) return false;
+    }
+    *token = (char)t;
+    return true;
+}
+
+size_t ft::Lz::compress(const char* src, size_t len, char* dst, size_t capacity) {
+    char* op = dst;
+    const char* end = dst + capacity;
+    size_t anchor = 0;
+
+    if (len >= LZ_MIN_BLOCK) {
+        // positions + 1, so 0 is empty
+        uint32_t table[1 << LZ_HASH_LOG];
+        memset(table, 0, sizeof(table));
+        size_t matchLimit = len - LZ_LAST_LITERALS;
+        size_t ip = 0;
+
+        while (ip + LZ_MIN_MATCH <= matchLimit) {
+            uint32_t seq = read32(src + ip);
+            uint32_t h = hash32(seq);
+            size_t ref = table[h];
+            table[h] = ip + 1;
+            if (ref == 0 || ip - (ref - 1) > LZ_MAX_OFFSET || read32(src + ref - 1) != seq) {
+                ip++;
+                continue;
+            }
+            ref--;
+
+            size_t matchLen = LZ_MIN_MATCH;
+            while (ip + matchLen < matchLimit && src[ref + matchLen] == src[ip + matchLen]) {
+                matchLen++;
+            }
+            if (!putSequence(op, end, src + anchor, ip - anchor, ip - ref, matchLen)) {
+                return 0;
+            }
+            ip += matchLen;
+            anchor = ip;
+        }
+    }
+
+    if (!putSequence(op, end, src + anchor, len - anchor, 0, 0)) {
+        return 0;
+    }
+    return op - dst;
+}
+
+// Read the continuation bytes of a nibble that reached 15
+static inline bool getLength(const char*& ip, const char* end, size_t* n) {
+    uint8_t b;
+    do {
+        if (ip >= end) return false;
+        b = *ip++;
+        *n += b;
+    } while (b == 255);
+    return true;
+}
+
+int ft::Lz::decompress(const char* src, size_t len, char* dst, size_t capacity, size_t* outLen) {
+    const char* ip = src;
+    const char* end = src + len;
+    char* op = dst;
+    char* oend = dst + capacity;
+
+    while (ip < end) {
+        uint8_t token = *ip++;
+        size_t numLiterals = token >> 4;
+        if (numLiterals == 15 && !getLength(ip, end, &numLiterals)) {
+            return KVCG_EINVALID;
+        }
+        if ((size_t)(end - ip) < numLiterals || (size_t)(oend - op) < numLiterals) {
+            return KVCG_EINVALID;
+        }
+        memcpy(op, ip, numLiterals);
+        ip += numLiterals;
+        op += numLiterals;
+        if (ip == end) {
+            // last sequence
+            break;
+        }
+
+        if (end - ip < 2) {
+            return KVCG_EINVALID;
+        }
+        size_t offset = (uint8_t)ip[0] | ((size_t)(uint8_t)ip[1] << 8);
+        ip += 2;
+        size_t matchLen = token & 0x0F;
+        if (matchLen == 15 && !getLength(ip, end, &matchLen)) {
+            return KVCG_EINVALID;
+        }
+        matchLen += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(op - dst) || (size_t)(oend - op) < matchLen) {
+            return KVCG_EINVALID;
+        }
+        // may overlap its own output, copy forward a byte at a time
+        const char* match = op - offset;
+        for (size_t i = 0; i < matchLen; i++) {
+            op[i] = match[i];
+        }
+        op += matchLen;
+    }
+
+    *outLen = op - dst;
+    return KVCG_ESUCCESS;
+}
@@ -0,0 +1,84 @@
+/****************************************************
+ *
+ * Phi Accrual Failure Detector Implementation
+ *
+ ****************************************************/
+#include <faulttolerance/phi_accrual.h>
+
+#include <cmath>
+#include <algorithm>
+
+namespace ft = cse498::faulttolerance;
+
+ft::PhiAccrualDetector::PhiAccrualDetector(double expectedIntervalMs, double minStdDevMs) :
+    minStdDevMs(minStdDevMs), expectedIntervalMs(expectedIntervalMs) {
+    reset();
+}
+
+void ft::PhiAccrualDetector::reset() {
+    intervals.clear();
+    next = 0;
+    sum = 0;
+    sumSq = 0;
+    started = false;
+    // Until there are real samples assume heartbeats arrive on time,
+    // give or take a quarter of the interval
+    double dev = expectedIntervalMs / 4;
+    addInterval(expectedIntervalMs - dev);
+    addInterval(expectedIntervalMs + dev);
+}
+
+void ft::PhiAccrualDetector::addInterval(double ms) {
+    if (intervals.size() < PHI_WINDOW) {
+        intervals.push_back(ms);
+    } else {
+        double old = intervals[next];
+        sum -= old;
+        sumSq -= old*old;
+        intervals[next] = ms;
+        next = (next + 1) % PHI_WINDOW;
+    }
+    sum += ms;
+    sumSq += ms*ms;
+}
+
+void ft::PhiAccrualDetector::heartbeat(std::chrono::steady_clock::time_point now) {
+    if (started) {
+        addInterval(std::chrono::duration<double, std::milli>(now - last).count());
+    }
+    started = true;
+    last = now;
+}
+
+void ft::PhiAccrualDetector::alive(std::chrono::steady_clock::time_point now) {
+    if (!started || now > last) {
+        last = now;
+    }
+    started = true;
+}
+
+double ft::PhiAccrualDetector::sinceLastMs(std::chrono::steady_clock::time_point now) {
+    if (!started) {
+        return 0;
+    }
+    return std::chrono::duration<double, std::milli>(now - last).count();
+}
+
+double ft::PhiAccrualDetector::phi(std::chrono::steady_clock::time_point now) {
+    if (!started) {
+        return 0;
+    }
+    double n = intervals.size();
+    double mean = sum / n;
+    // running sums can drift slightly negative
+    double variance = std::max(0.0, sumSq / n - mean*mean);
+    double stdDev = std::max(std::sqrt(variance), minStdDevMs);
+
+    // chance a heartbeat from this distribution arrives even later
+    double y = (sinceLastMs(now) - mean) / stdDev;
+    double pLater = 0.5 * std::erfc(y / std::sqrt(2.0));
+    if (pLater <= 0) {
+        return INFINITY;
+    }
+    return -std::log10(pLater);
+}
@@ -6,10 +6,16 @@
 #include <faulttolerance/server.h>
 #include <faulttolerance/kvcg_config.h>
 #include <faulttolerance/fault_tolerance.h>
+#include <faulttolerance/log_batch.h>
+#include <faulttolerance/ft_logging.h>
 
 #include <iostream>
-#include <bitset>
 #include <algorithm>
+#include <random>
+#include <pthread.h>
+#include <sched.h>
+#include <cerrno>
+#include <sys/stat.h>
 #include <assert.h>
 #include <chrono>
 #include <unistd.h>
@@ -39,65 +45,98 @@ const auto HOSTNAME = boost::asio::ip::host_name();
 
 std::atomic<bool> shutting_down(false);
 
-// timeout in seconds to assume heartbeat failure
-#define HB_TIMEOUT 2
-
-void ft::Server::beat_heart(ft::Server* backup) {
-  // Write to our backups memory region that we are alive
-  unsigned int count = 0;
-
-  cse498::unique_buf buf(4);
-  uint64_t bufKey = 3;
-  backup->backup_conn->register_mr(
-                    buf,
-                    FI_SEND | FI_RECV | FI_WRITE | FI_REMOTE_WRITE | FI_READ | FI_REMOTE_READ,
-                    bufKey);
+void ft::Server::startHeartbeat(ft::Server* backup) {
+  std::unique_lock<std::mutex> lock(heartbeatLock);
+  if (backup->heartbeating) {
+    return;
+  }
+  backup->heartbeating = true;
+  backup->heartbeatCount = 0;
+  heartbeatWheel.schedule((uint64_t)backup, 0);
+}
 
+void ft::Server::heartbeat_loop() {
+  // Write to our backups memory regions that we are alive
+  std::vector<uint64_t> due;
+  auto next = std::chrono::steady_clock::now();
 
   while(!shutting_down) {
-    sprintf(buf.get(), "%03d", count); // always send 4 bytes
-    LOG(TRACE) << "Sending " << backup->getName() << " heartbeat=" << buf.get() << " (MRKEY:" << backup->heartbeat_key <<", ADDR:" << backup->heartbeat_addr << ")";
-    if(!backup->backup_conn->try_write(buf, 4, backup->heartbeat_addr, backup->heartbeat_key)) {
-        // Backup must have failed. reissue connect
+    // tick against a fixed schedule so send time does not add drift
+    next += std::chrono::milliseconds(heartbeatWheel.getTickMs());
+    std::this_thread::sleep_until(next);
+
+    due.clear();
+    {
+      std::unique_lock<std::mutex> lock(heartbeatLock);
+      heartbeatWheel.tick(due);
+    }
+    auto now = std::chrono::steady_clock::now();
+
+    for (auto id : due) {
+      ft::Server* backup = (ft::Server*)id;
+
+      // A log write since the last beat already told the backup we are
+      // alive, check again an interval after it. The first beat is always
+      // sent, the backup waits for it before reading logs.
+      auto sinceLog = std::chrono::duration_cast<std::chrono::milliseconds>(now - backup->lastLogWrite.load()).count();
+      if (backup->heartbeatCount > 0 && sinceLog < heartbeatIntervalMs) {
+        FT_LOG(TRACE) << "Skipping heartbeat to " << backup->getName() << ", logged " << sinceLog << "ms ago";
+        std::unique_lock<std::mutex> lock(heartbeatLock);
+        heartbeatWheel.schedule(id, heartbeatIntervalMs - sinceLog);
+        continue;
+      }
+
+      backup->heartbeatCount++;
+      memcpy(backup->heartbeatSendBuf.get(), &backup->heartbeatCount, sizeof(uint64_t));
+      FT_LOG(TRACE) << "Sending " << backup->getName() << " heartbeat=" << backup->heartbeatCount << " (MRKEY:" << backup->heartbeat_key <<", ADDR:" << backup->heartbeat_addr << ")";
+      if(!backup->backup_conn->try_write(backup->heartbeatSendBuf, sizeof(uint64_t), backup->heartbeat_addr, backup->heartbeat_key)) {
         LOG(WARNING) << "Backup server " << backup->getName() << " went down";
         backup->alive = false;
+        {
+          std::unique_lock<std::mutex> lock(heartbeatLock);
+          backup->heartbeating = false;
+        }
         if(std::find(primaryServers.begin(), primaryServers.end(), backup) != primaryServers.end()) {
-            LOG(DEBUG3) << "Server " << backup->getName() << " is also a primary, handling in primary_listen";
-            return; 
-        }
-        // FIXME: Segfault in network-layer, memory leak though by not deleting
-        //delete backup->backup_conn;
-
-        // Check original state of failed backup. The failed server could
-        // have original been a primary that became our backup after failing.
-        // When it fails, it will come back up trying to be primary again.
-        // TODO: Run in detached thread in case it never comes back?
-        auto elem = std::find(originalPrimaryServers.begin(), originalPrimaryServers.end(), backup);
-        if(elem != originalPrimaryServers.end()) {
-            // failed server will come back as a primary, open backup endpoint to accept connect_backups()
-            LOG(DEBUG3) << backup->getName() << " was originally our primary, open endpoint for it";
-            open_backup_endpoints(backup, 'p', 0, nullptr);
-        } else {
-            // failed server will come back as a backup, issue connect_backups to it
-            LOG(DEBUG3) << backup->getName() << " was originally a backup, issue connection to it";
-            connect_backups(backup, true);
+          FT_LOG(DEBUG3) << "Server " << backup->getName() << " is also a primary, handling in its poller";
+          continue;
         }
+        // Reconnecting blocks until it comes back or we shut down, keep beating the others
+        {
+          std::unique_lock<std::mutex> lock(recoverLock);
+          recoverThreads.emplace_back(&ft::Server::recoverBackup, this, backup);
+        }
+        continue;
+      }
+      trace.record(ft::TRACE_HEARTBEAT, backup->heartbeatCount, sinceLog);
 
-        return;
+      std::unique_lock<std::mutex> lock(heartbeatLock);
+      heartbeatWheel.schedule(id, heartbeatIntervalMs);
     }
-    count++;
-    if (count > 999) count = 0;
-    // don't go crazy spamming the network
-    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+}
+
+void ft::Server::recoverBackup(ft::Server* backup) {
+  // FIXME: Segfault in network-layer, memory leak though by not deleting
+  //delete backup->backup_conn;
+
+  // Check original state of failed backup. The failed server could
+  // have original been a primary that became our backup after failing.
+  // When it fails, it will come back up trying to be primary again.
+  auto elem = std::find(originalPrimaryServers.begin(), originalPrimaryServers.end(), backup);
+  if(elem != originalPrimaryServers.end()) {
+      // failed server will come back as a primary, open backup endpoint to accept connect_backups()
+      LOG(DEBUG3) << backup->getName() << " was originally our primary, open endpoint for it";
+      open_backup_endpoints(backup, 'p', 0, nullptr);
+  } else {
+      // failed server will come back as a backup, issue connect_backups to it
+      LOG(DEBUG3) << backup->getName() << " was originally a backup, issue connection to it";
+      connect_backups(backup, true);
   }
 }
 
 void ft::Server::client_listen() {
   LOG(INFO) << "Waiting for client discovery requests...";
-  int offset = 0;
-  uint64_t bufKey = 0;
-  size_t numRanges;
-  while(true) {
+  while(!shutting_down) {
     cse498::Connection* conn = new cse498::Connection(
         this->getAddr().c_str(),
         true, this->clientPort, this->provider);
@@ -107,166 +146,405 @@ void ft::Server::client_listen() {
         continue;
     }
 
-    // Client connected to us, must be discovering leaders
-    // Respond with a list of our primary key ranges
+    // Client connected to us, must be discovering leaders.
+    // Hand it off so we can go back to accepting.
+    std::unique_lock<std::mutex> lock(discoveryQueueLock);
+    discoveryQueue.push_back(conn);
+    discoveryQueueCv.notify_one();
+  }
+}
 
-    // Ensure primaryKeys are not adjusted by another thread
-    primaryKeysLock.lock();
+void ft::Server::discovery_handshake() {
+  // Give a newly connected client access to our published key ranges.
+  // After this the client queries by reading discovery_mr directly,
+  // so the connection is kept open and needs no more work from us.
+  cse498::unique_buf buf(DISCOVERY_MSG_SIZE);
+  uint64_t bufKey = 0;
+  uint64_t mrKey = (uint64_t)boost::hash_value(this->getName())*3;
+  uint64_t mrAddr = 0;
+  cse498::Connection* conn;
+
+  while(true) {
+    {
+      std::unique_lock<std::mutex> lock(discoveryQueueLock);
+      discoveryQueueCv.wait(lock, [this]() { return shutting_down || !discoveryQueue.empty(); });
+      if (shutting_down) return;
+      conn = discoveryQueue.front();
+      discoveryQueue.pop_front();
+    }
 
-    // calculate buffer size and initialize buffer
-    int bufSize = sizeof(size_t) + (primaryKeys.size() * (sizeof(unsigned long long)*2));
-    cse498::unique_buf buf(bufSize);
+    conn->register_mr(discovery_mr, FI_SEND | FI_RECV | FI_READ | FI_REMOTE_READ, mrKey);
     conn->register_mr(buf, FI_SEND | FI_RECV, bufKey);
 
-    // Load up buffer with key ranges
-    // First value will be the number of ranges (size_t)
-    // Followed by pairs of unsigned long longs.
-    offset = sizeof(size_t);
-    numRanges = primaryKeys.size();
-    memcpy(buf.get(), (void*)&numRanges, sizeof(size_t));
-    for (auto kr : primaryKeys) {
-        memcpy(buf.get()+offset, (void*)&(kr.first), sizeof(unsigned long long));
-        offset += sizeof(unsigned long long);
-        memcpy(buf.get()+offset, (void*)&(kr.second), sizeof(unsigned long long));
-        offset += sizeof(unsigned long long);
+    // Send MR key and address, followed by the current range list
+    // so the first query does not need a read
+    if (this->provider != cse498::Sockets) {
+        mrAddr = (uint64_t)discovery_mr.get();
     }
-
-    // unlock primaryKeys
+    memcpy(buf.get(), &mrKey, sizeof(uint64_t));
+    memcpy(buf.get()+sizeof(uint64_t), &mrAddr, sizeof(uint64_t));
+    primaryKeysLock.lock();
+    memcpy(buf.get()+2*sizeof(uint64_t), discovery_mr.get(), DISCOVERY_SIZE);
     primaryKeysLock.unlock();
+    conn->send(buf, DISCOVERY_MSG_SIZE);
+
+    std::unique_lock<std::mutex> lock(discoveryQueueLock);
+    discoveryConns.push_back(conn);
+    if (discoveryConns.size() > DISCOVERY_MAX_CLIENTS) {
+        // Client will reconnect if it is still around
+        LOG(DEBUG2) << "Closing oldest discovery connection";
+        delete discoveryConns.front();
+        discoveryConns.pop_front();
+    }
+  }
+}
 
-    // Double-check we allocated the propery amount and primaryKeys were locked
-    assert(bufSize == offset);
+void ft::Server::publishPrimaryKeys() {
+  // Caller must hold primaryKeysLock
+  primaryKeyIndex.publish(primaryKeys);
+  discoveryVersion += 2;
+  encodeKeyRanges(discovery_mr.get(), discoveryVersion, primaryKeys);
+}
+
+void ft::Server::encodeKeyRanges(char* buf, uint64_t version, const std::vector<std::pair<unsigned long long, unsigned long long>>& ranges) {
+  // Layout: [version][numRanges][min,max]...[version]
+  // Clients read this without locking, so it is written seqlock style.
+  // The leading version is odd while the list is being changed and a
+  // reader only accepts the list when both copies match and the leading
+  // version is unchanged when read again after the list.
+  uint64_t maxRanges = (DISCOVERY_SIZE - 3*sizeof(uint64_t)) / (2*sizeof(unsigned long long));
+  uint64_t numRanges = ranges.size();
+  if (numRanges > maxRanges) {
+      LOG(ERROR) << "Too many key ranges to publish (" << numRanges << "), only sending " << maxRanges;
+      numRanges = maxRanges;
+  }
+  uint64_t writing = version - 1;
+  memcpy(buf, &writing, sizeof(uint64_t));
+  std::atomic_thread_fence(std::memory_order_release);
+
+  size_t offset = sizeof(uint64_t);
+  memcpy(buf+offset, &numRanges, sizeof(uint64_t));
+  offset += sizeof(uint64_t);
+  for (uint64_t i=0; i < numRanges; i++) {
+      memcpy(buf+offset, &ranges[i].first, sizeof(unsigned long long));
+      offset += sizeof(unsigned long long);
+      memcpy(buf+offset, &ranges[i].second, sizeof(unsigned long long));
+      offset += sizeof(unsigned long long);
+  }
+  memcpy(buf+offset, &version, sizeof(uint64_t));
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(buf, &version, sizeof(uint64_t));
+}
 
-    // Send buffer to client
-    conn->send(buf, offset);
+bool ft::Server::decodeKeyRanges(const char* buf, std::vector<std::pair<unsigned long long, unsigned long long>>* ranges, uint64_t* versionOut /* DEFAULT nullptr */) {
+  uint64_t maxRanges = (DISCOVERY_SIZE - 3*sizeof(uint64_t)) / (2*sizeof(unsigned long long));
+  uint64_t version, trailer, numRanges;
+  unsigned long long minKey, maxKey;
 
-    // Close connection to prepare for next discovery request
-    delete conn;
+  memcpy(&version, buf, sizeof(uint64_t));
+  memcpy(&numRanges, buf+sizeof(uint64_t), sizeof(uint64_t));
+  if (version == 0 || version % 2 != 0 || numRanges > maxRanges) {
+      // never published, or caught mid-update
+      return false;
+  }
+  size_t offset = 2*sizeof(uint64_t);
+  memcpy(&trailer, buf+offset+numRanges*2*sizeof(unsigned long long), sizeof(uint64_t));
+  if (trailer != version) {
+      return false;
   }
+
+  ranges->clear();
+  for (uint64_t i=0; i < numRanges; i++) {
+      memcpy(&minKey, buf+offset, sizeof(unsigned long long));
+      offset += sizeof(unsigned long long);
+      memcpy(&maxKey, buf+offset, sizeof(unsigned long long));
+      offset += sizeof(unsigned long long);
+      ranges->push_back({minKey, maxKey});
+  }
+  if (versionOut != nullptr) {
+      *versionOut = version;
+  }
+  return true;
 }
 
-void ft::Server::primary_listen(ft::Server* pserver) {
-    int r;
-    cse498::unique_buf buffer(MAX_LOG_SIZE);
-    ft::Server* primServer = pserver; // May change over time
-    bool remote_closed = false;
-    size_t offset, bytesConsumed;
-    char localBuf[pserver->logging_mr.size()];
+int ft::Server::queryPrimaryRanges(std::vector<std::pair<unsigned long long, unsigned long long>>* ranges) {
+  // Called by clients on their copy of a remote server
+  std::unique_lock<std::mutex> lock(discoveryLock);
+  uint64_t bufKey = 0;
 
-    auto last_check = std::chrono::steady_clock::now();
-    auto curr_time = std::chrono::steady_clock::now();
-    int curr_heartbeat = 0;
-    int prev_heartbeat = 0;
+  // Allow one reconnect if an existing connection has gone stale
+  for (int attempt=0; attempt < 2; attempt++) {
+      if (discovery_conn == nullptr) {
+          // Try to establish connection to server (non-blocking, assume down if unable)
+          discovery_conn = new cse498::Connection(this->getAddr().c_str(), false, this->getClientPort(), this->getProvider());
+          if(!discovery_conn->connect()) {
+              LOG(DEBUG2) << "Could not connect to " << this->getName();
+              delete discovery_conn;
+              discovery_conn = nullptr;
+              return KVCG_EBADCONN;
+          }
+          discovery_conn->register_mr(discovery_buf, FI_SEND | FI_RECV | FI_READ | FI_WRITE, bufKey);
+          discovery_conn->recv(discovery_buf, DISCOVERY_MSG_SIZE);
+          memcpy(&discovery_key, discovery_buf.get(), sizeof(uint64_t));
+          memcpy(&discovery_addr, discovery_buf.get()+sizeof(uint64_t), sizeof(uint64_t));
+          if (decodeKeyRanges(discovery_buf.get()+2*sizeof(uint64_t), ranges)) {
+              return KVCG_ESUCCESS;
+          }
+      }
+
+      // Read the server's published list, retrying if we raced an update.
+      // A shorter list can leave the old trailer in place, so matching
+      // copies alone do not rule out a torn read. The list is only taken
+      // if the version is the same when read again afterwards.
+      for (int retry=0; retry < 8; retry++) {
+          uint64_t version;
+          discovery_conn->read(discovery_buf, DISCOVERY_SIZE, discovery_addr, discovery_key);
+          if (!decodeKeyRanges(discovery_buf.get(), ranges, &version)) {
+              continue;
+          }
+          discovery_conn->read(discovery_buf, sizeof(uint64_t), discovery_addr, discovery_key);
+          if (memcmp(discovery_buf.get(), &version, sizeof(uint64_t)) == 0) {
+              return KVCG_ESUCCESS;
+          }
+      }
 
-    while(true) {
+      LOG(DEBUG2) << "Discovery connection to " << this->getName() << " is stale, reconnecting";
+      delete discovery_conn;
+      discovery_conn = nullptr;
+  }
+  return KVCG_EBADCONN;
+}
 
+void ft::Server::watchPrimary(ft::Server* primServer) {
+    // heartbeats are half an interval apart give or take, at the very least
+    PrimaryWatch* watch = new PrimaryWatch(primServer, heartbeatIntervalMs, heartbeatIntervalMs / 2.0, logSlotSize);
+    Poller* poller = pollers[nextPoller++ % pollers.size()].get();
+    LOG(DEBUG) << "Waiting for initial heart beat from " << primServer->getName();
+    std::unique_lock<std::mutex> lock(poller->lock);
+    poller->added.push_back(watch);
+    poller->hasAdded = true;
+}
+
+void ft::Server::failover(ft::Server* primServer, ft::Server* expNewPrimary) {
+    ft::Server* newPrimary = handlePrimaryFailure(primServer, expNewPrimary);
+    if (newPrimary == nullptr || newPrimary->getName() == this->getName()) {
+        // we took over, or are already watching the new primary
+        return;
+    }
+    watchPrimary(newPrimary);
+}
+
+void ft::Server::startFailover(ft::Server* primServer, ft::Server* expNewPrimary) {
+    std::unique_lock<std::mutex> lock(failoverLock);
+    failoverThreads.emplace_back(&ft::Server::failover, this, primServer, expNewPrimary);
+}
+
+ft::Server::PollResult ft::Server::pollPrimary(PrimaryWatch* watch, std::chrono::steady_clock::time_point now) {
+    ft::Server* primServer = watch->primServer;
+    ft::LogBatchReader reader;
+    // decode target, values are left in the slot
+    data_t value;
+    RequestWrapper<unsigned long long, data_t*> decoded{0, 0, &value, 0};
+    RequestWrapper<unsigned long long, data_t*>* pkt = &decoded;
+
+    uint64_t heartbeat = *(volatile uint64_t*)primServer->heartbeat_mr.get();
+    if (!watch->started) {
         // wait for primary to come to life
-        LOG(DEBUG) << "Waiting for initial heart beat from " << primServer->getName();
-        while(primServer->heartbeat_mr.get()[0] == '-') {
-            //LOG(TRACE) << primServer->getName() << "hb:" << primServer->heartbeat_mr.get();
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        if (heartbeat == 0) {
+            return POLL_IDLE;
         }
-
         LOG(INFO) << "Waiting for backup requests from " << primServer->getName();
-        last_check = std::chrono::steady_clock::now();
-        remote_closed = false;
-
-        while(true) {
-          if (shutting_down) break;
+        watch->started = true;
+        watch->heartbeat = heartbeat;
+        watch->detector.reset();
+        watch->detector.heartbeat(now);
+        return POLL_WORK;
+    }
 
-          curr_time = std::chrono::steady_clock::now();
+    if (heartbeat != watch->heartbeat) {
+        FT_LOG(TRACE) << "Heartbeat:" << primServer->getName() << ": " << watch->heartbeat << "->" << heartbeat;
+        watch->heartbeat = heartbeat;
+        watch->detector.heartbeat(now);
+    } else {
+        // Suspect the primary once a heartbeat this late is unlikely given
+        // how they have been arriving, but never wait past the timeout
+        double phi = watch->detector.phi(now);
+        if ((phiThreshold > 0 && phi > phiThreshold) || watch->detector.sinceLastMs(now) > heartbeatTimeoutMs) {
+            LOG(WARNING) << "Heartbeat failure detected for " << primServer->getName() << " (phi " << phi << " after "
+                         << watch->detector.sinceLastMs(now) << "ms, mean interval " << watch->detector.getMeanMs() << "ms)";
+            // Resolving the new primary may block, keep polling the others
+            startFailover(primServer, nullptr);
+            return POLL_DONE;
+        }
+    }
 
-          prev_heartbeat = curr_heartbeat;
-          curr_heartbeat = atoi(primServer->heartbeat_mr.get());
-          if (curr_heartbeat == prev_heartbeat &&
-                  std::chrono::duration_cast<std::chrono::seconds>(curr_time - last_check).count() > HB_TIMEOUT) {
-              // heartbeat has not updated within timeout, assume primary died
-              LOG(WARNING) << "Heartbeat failure detected for " << primServer->getName();
-              remote_closed = true;
-              break;
-          } else if (curr_heartbeat != prev_heartbeat) {
-              // reset heartbeat timeout
-              LOG(TRACE) << "Heartbeat:" << primServer->getName() << ": " << prev_heartbeat << "->" << curr_heartbeat;
-              last_check = std::chrono::steady_clock::now();
-          }
+    char* slot = primServer->logging_mr.get() + LOG_RING_HDR_SIZE + (primServer->logRingNext % LOG_RING_SLOTS)*logSlotSize;
+    char msgType = slot[0];
+    if (msgType == 'l') {
+        // primary skips heartbeats while it is sending logs
+        watch->detector.alive(now);
+        if (reader.open(slot, logSlotSize, watch->scratch.data(), watch->scratch.size())) {
+            LOG(ERROR) << "Dropping unreadable log batch (version " << (unsigned)(uint8_t)slot[1] << ") from " << primServer->getName();
+            slot[0] = '\0';
+            primServer->logRingNext++;
+            memcpy(primServer->logging_mr.get(), &primServer->logRingNext, sizeof(uint64_t));
+            return POLL_WORK;
+        }
+        FT_LOG(DEBUG2) << "Read "<< reader.size() << " updates from " << primServer->getName() << " (slot " << primServer->logRingNext << ")";
+    } else if (msgType == 'p') {
+        // Primary server determined one of its backups took over
+        // Start listening to them instead.
+        ft::Server* expNewPrimary = nullptr;
+        std::string newName = slot+1;
+        slot[0] = '\0';
+        primServer->logRingNext++;
+        memcpy(primServer->logging_mr.get(), &primServer->logRingNext, sizeof(uint64_t));
+        FT_LOG(DEBUG2) << "Primary " << primServer->getName() << " determined new primary name is " << newName;
+        for (auto &b : primServer->getBackupServers()) {
+            if (b->getName() == newName) {
+                expNewPrimary = b;
+                break;
+            }
+        }
+        assert(expNewPrimary != nullptr);
+        startFailover(primServer, expNewPrimary);
+        return POLL_DONE;
+    } else {
+        return POLL_IDLE;
+    }
 
-          RequestWrapper<unsigned long long, data_t*>* pkt;
-
-          char msgType = primServer->logging_mr.get()[0];
-          uint8_t numLogs = 0;
-          if (msgType == 'l') {
-            numLogs = primServer->logging_mr.get()[1];
-            LOG(DEBUG2) << "Read "<< unsigned(numLogs) << " updates from " << primServer->getName();
-            memcpy(localBuf, primServer->logging_mr.get(), primServer->logging_mr.size());
-            // prepare for next write immediately
-            primServer->logging_mr.get()[0] = '\0';
-          } else if (msgType == 'p') {
-            // Primary server determined one of its backups took over
-            // Start listening to them instead.
-            ft::Server* expNewPrimary = nullptr;
-            std::string newName = primServer->logging_mr.get()+1;
-            LOG(DEBUG2) << "Primary " << primServer->getName() << " determined new primary name is " << newName;
-            for (auto &b : primServer->getBackupServers()) {
-                if (b->getName() == newName) {
-                    expNewPrimary = b;
-                    break;
-                }
+    // Apply straight from the slot, values are copied once into the log
+    // history. The primary keeps filling the other ring slots meanwhile.
+    bool complete = true;
+    primServer->logged_putsLock.lock();
+    while (reader.next(pkt)) {
+        if (reader.isChunk()) {
+            // Collect the parts of a large value, they arrive in order.
+            // The entry is only replaced once the value is whole.
+            // The full length comes off the wire, never size a buffer past
+            // what any primary may log.
+            if (reader.getChunkTotal() > maxValueSize || reader.getChunkOffset() > reader.getChunkTotal() ||
+                pkt->value->size > reader.getChunkTotal() - reader.getChunkOffset()) {
+                LOG(ERROR) << "Dropping chunk of key " << pkt->key << " from " << primServer->getName()
+                           << ", value of " << reader.getChunkTotal() << " bytes is over " << maxValueSize;
+                std::vector<char>().swap(watch->chunkData);
+                complete = false;
+                continue;
             }
-            assert(expNewPrimary != nullptr);
-            ft::Server* newPrimary = handlePrimaryFailure(primServer, expNewPrimary);
-            if (newPrimary == nullptr) {
-                return; // must be listening already in another thread
+            if (reader.getChunkOffset() == 0) {
+                watch->chunkKey = pkt->key;
+                watch->chunkData.resize(reader.getChunkTotal());
+                watch->chunkReceived = 0;
+            } else if (watch->chunkData.empty() || pkt->key != watch->chunkKey ||
+                       reader.getChunkOffset() != watch->chunkReceived || reader.getChunkTotal() != watch->chunkData.size()) {
+                LOG(ERROR) << "Dropping out of order chunk of key " << pkt->key << " from " << primServer->getName();
+                std::vector<char>().swap(watch->chunkData);
+                complete = false;
+                continue;
             }
-            primServer = newPrimary;
-            continue;
-          } else {
-            continue;
-          }
-
-          offset = 0;
-          primServer->logged_putsLock.lock();
-          for(int i=0; i < numLogs; i++) {
-            pkt = new RequestWrapper<unsigned long long, data_t*>();
-            *pkt = deserialize2<RequestWrapper<unsigned long long, data_t*>>(localBuf+2+offset, primServer->logging_mr.size()-2-offset, bytesConsumed);
-            offset += bytesConsumed;
-            if (pkt->requestInteger == REQUEST_INSERT) {
-              LOG(INFO) << "Received from " << primServer->getName() << ": INSERT (" << pkt->key << "," << pkt->value->data << ")";
-            } else if (pkt->requestInteger == REQUEST_REMOVE) {
-              LOG(INFO) << "Received from " << primServer->getName() << ": REMOVE (" << pkt->key << "," << pkt->value->data << ")";
-            } else {
-              LOG(ERROR) << "Received unexpected request from " << primServer->getName() << ": " << pkt->requestInteger;
+            memcpy(watch->chunkData.data() + reader.getChunkOffset(), pkt->value->data, pkt->value->size);
+            watch->chunkReceived += pkt->value->size;
+            if (watch->chunkReceived < watch->chunkData.size()) {
+                continue;
             }
+            pkt->value->data = watch->chunkData.data();
+            pkt->value->size = watch->chunkData.size();
+        }
+
+        if (pkt->requestInteger == REQUEST_INSERT) {
+          FT_LOG(INFO) << "Received from " << primServer->getName() << ": INSERT (" << pkt->key << "," << std::string(pkt->value->data, pkt->value->size) << ")";
+        } else if (pkt->requestInteger == REQUEST_REMOVE) {
+          FT_LOG(INFO) << "Received from " << primServer->getName() << ": REMOVE (" << pkt->key << "," << std::string(pkt->value->data, pkt->value->size) << ")";
+        } else {
+          LOG(ERROR) << "Received unexpected request from " << primServer->getName() << ": " << pkt->requestInteger;
+        }
 
 
-            // Add to queue for this primary server
-            auto elem = primServer->logged_puts->find(pkt->key);
-            assert(elem != primServer->logged_puts->end());
-            LOG(DEBUG4) << "Replacing log entry for " << primServer->getName() << " key " << pkt->key << ": " << elem->second->value->data << "->" << pkt->value->data;
-            elem->second->value->size = pkt->value->size;
-            elem->second->requestInteger = pkt->requestInteger;
-            memcpy(elem->second->value->data, pkt->value->data, pkt->value->size);
-            // There isn't a good destructor for this
-            delete pkt->value->data;
-            delete pkt->value;
-            delete pkt;
-          }
-          primServer->traceLogRecord();
-          primServer->logged_putsLock.unlock();
+        // Add to log history for this primary server
+        FT_LOG(DEBUG4) << "Replacing log entry for " << primServer->getName() << " key " << pkt->key << ": " << std::string(pkt->value->data, pkt->value->size);
+        primServer->setLogEntry(pkt->key, pkt->requestInteger, pkt->value, reader.getEntrySeq());
+        trace.record(ft::TRACE_LOG_APPLY, pkt->key, pkt->value->size);
+        if (reader.isChunk()) {
+            std::vector<char>().swap(watch->chunkData);
         }
+    }
+    if (!reader.done()) {
+        LOG(ERROR) << "Malformed log batch from " << primServer->getName() << ", dropped the rest of its " << reader.size() << " updates";
+        complete = false;
+    }
+    // Everything up to the batch's sequence number has now been applied,
+    // but only if it follows on from the last batch applied in full. After
+    // a gap logSeq stays put, so a reconnect restores from before it.
+    if (reader.getBaseSeq() != primServer->logSeq) {
+        FT_LOG(DEBUG2) << "Log batch from " << primServer->getName() << " follows " << reader.getBaseSeq() << ", have up to " << primServer->logSeq;
+    } else if (complete && reader.getSeq() != 0) {
+        primServer->logSeq = reader.getSeq();
+    }
+    primServer->traceLogRecord();
+    primServer->logged_putsLock.unlock();
+
+    // release slot so primary can reuse it
+    slot[0] = '\0';
+    primServer->logRingNext++;
+    memcpy(primServer->logging_mr.get(), &primServer->logRingNext, sizeof(uint64_t));
+    return POLL_WORK;
+}
 
-        if (shutting_down)
-            return;
+void ft::Server::poll_primaries(Poller* poller, int cpu) {
+    // Poll every primary watched by this poller. Busy polling keeps apply
+    // latency low while logs are flowing; once idle, back off from
+    // spinning to yielding to sleeping so idle primaries cost no core.
+    std::vector<PrimaryWatch*> watches;
+    unsigned int idleRounds = 0;
+
+    if (cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if (err) {
+            LOG(WARNING) << "Failed to pin poller to CPU " << cpu << ": " << strerror(err);
+        } else {
+            LOG(DEBUG2) << "Pinned poller to CPU " << cpu;
+        }
+    }
 
-        if (remote_closed) {
-            ft::Server* newPrimary = handlePrimaryFailure(primServer);
-            if (newPrimary == nullptr || newPrimary->getName() == this->getName()) {
-                return;
-            } else {
-                // continue this thread
-                primServer = newPrimary;
+    while (!shutting_down) {
+        if (poller->hasAdded) {
+            std::unique_lock<std::mutex> lock(poller->lock);
+            watches.insert(watches.end(), poller->added.begin(), poller->added.end());
+            poller->added.clear();
+            poller->hasAdded = false;
+        }
+
+        bool busy = false;
+        auto now = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < watches.size(); ) {
+            PollResult r = pollPrimary(watches[i], now);
+            if (r == POLL_DONE) {
+                delete watches[i];
+                watches[i] = watches.back();
+                watches.pop_back();
+                continue;
             }
+            busy |= (r == POLL_WORK);
+            i++;
+        }
+
+        if (busy) {
+            idleRounds = 0;
+        } else if (++idleRounds <= POLL_SPIN_ROUNDS) {
+            continue;
+        } else if (idleRounds <= POLL_SPIN_ROUNDS + POLL_YIELD_ROUNDS) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(POLL_SLEEP_US));
         }
     }
+
+    for (auto w : watches) {
+        delete w;
+    }
 }
 
 ft::Server* ft::Server::handlePrimaryFailure(ft::Server* primServer, ft::Server* expNewPrimary /* nullptr */) {
@@ -328,18 +606,12 @@ ft::Server* ft::Server::handlePrimaryFailure(ft::Server* primServer, ft::Server*
             this->logged_putsLock.lock();
             primServer->logged_putsLock.lock();
             for (auto it = primServer->logged_puts->begin(); it != primServer->logged_puts->end(); ++it) {
-                if (it->second->value->data[0] != '\0') {
-                  LOG(DEBUG) << "  Commit: ("  << it->second->key << "," << it->second->value->data << ")";
-                  commitBatch.push_back(*(it->second));
-                  auto elem = this->logged_puts->find(it->first);
-                  //assert(elem->second->value->data[0] == '\0');
-                  elem->second->requestInteger = it->second->requestInteger;
-                  elem->second->value->size = it->second->value->size;
-                  memcpy(elem->second->value->data, it->second->value->data, it->second->value->size);
-                  it->second->value->size = 0;
-                  it->second->value->data[0] = '\0';
-                }
+                LOG(DEBUG) << "  Commit: ("  << it->second->key << "," << std::string(it->second->value->data, it->second->value->size) << ")";
+                // renumber in our stream so our backups' catch-up includes them
+                this->setLogEntry(it->first, it->second->requestInteger, it->second->value, ++this->logSeq);
+                commitBatch.push_back(*(this->logged_puts->find(it->first)->second));
             }
+            primServer->clearLogEntries();
             this->traceLogRecord();
             primServer->logged_putsLock.unlock();
             this->logged_putsLock.unlock();
@@ -364,7 +636,7 @@ ft::Server* ft::Server::handlePrimaryFailure(ft::Server* primServer, ft::Server*
                         LOG(DEBUG2) << "Already backing up to " << newBackup->getName() << ", adding keys";
                         for (auto const &kr : primServer->primaryKeys) {
                             LOG(DEBUG3) << "  Adding backup key range [" << kr.first << ", " << kr.second << "]" << " to " << newBackup->getName();
-                            existingBackup->backupKeys.push_back(kr);
+                            existingBackup->addBackupKeyRange(kr);
                         }
                         exists = true;
                         break;
@@ -376,7 +648,7 @@ ft::Server* ft::Server::handlePrimaryFailure(ft::Server* primServer, ft::Server*
                     addBackupServer(newBackup);
                     for (auto const &kr : primServer->primaryKeys) {
                        LOG(DEBUG3) << "  Adding backup key range [" << kr.first << ", " << kr.second << "]" << " to " << newBackup->getName();
-                       newBackup->backupKeys.push_back(kr);
+                       newBackup->addBackupKeyRange(kr);
                     }
                     if (newBackup->getName() != primServer->getName()) {
                       // TBD: This is blocking, will wait forever on dead servers
@@ -424,16 +696,10 @@ ft::Server* ft::Server::handlePrimaryFailure(ft::Server* primServer, ft::Server*
             newPrimary->logged_putsLock.lock();
             primServer->logged_putsLock.lock();
             for (auto it = primServer->logged_puts->begin(); it != primServer->logged_puts->end(); ++it) {
-                if (it->second->value->data[0] != '\0') {
-                  LOG(DEBUG) << "  Copying to " << newPrimary->getName() << ": ("  << it->second->key << "," << it->second->value->data << ")";
-                  auto elem = newPrimary->logged_puts->find(it->first);
-                  elem->second->value->size = it->second->value->size;
-                  elem->second->requestInteger = it->second->requestInteger;
-                  memcpy(elem->second->value->data, it->second->value->data, it->second->value->size);
-                  it->second->value->data[0] = '\0';
-                  it->second->value->size = 0;
-                }
+                LOG(DEBUG) << "  Copying to " << newPrimary->getName() << ": ("  << it->second->key << "," << std::string(it->second->value->data, it->second->value->size) << ")";
+                newPrimary->setLogEntry(it->first, it->second->requestInteger, it->second->value);
             }
+            primServer->clearLogEntries();
             newPrimary->traceLogRecord();
             primServer->logged_putsLock.unlock();
             newPrimary->logged_putsLock.unlock();
@@ -446,7 +712,7 @@ ft::Server* ft::Server::handlePrimaryFailure(ft::Server* primServer, ft::Server*
                     LOG(DEBUG2) << "Already backing up " << newPrimary->getName() << ", adding keys";
                     for (auto const &kr : primServer->primaryKeys) {
                        LOG(DEBUG3) << "  Adding primary key range [" << kr.first << ", " << kr.second << "]" << " to " << newPrimary->getName();
-                       existingPrimary->primaryKeys.push_back(kr);
+                       existingPrimary->addKeyRange(kr);
                     }
                     exists = true;
                     break;
@@ -463,7 +729,7 @@ ft::Server* ft::Server::handlePrimaryFailure(ft::Server* primServer, ft::Server*
                     // connect_backups will clear primaryKeys, but needs them set to set the new primary's
                     // key range
                     // connect_backups will also add it to the primaryServers list
-                    primaryKeys = primServer->primaryKeys;
+                    setKeyRanges(primServer->getPrimaryKeys());
               
                     connect_backups(newPrimary, true);
                     primaryServers.erase(std::find(primaryServers.begin(), primaryServers.end(), primServer));
@@ -474,9 +740,9 @@ ft::Server* ft::Server::handlePrimaryFailure(ft::Server* primServer, ft::Server*
                     addPrimaryServer(newPrimary);
                     for (auto const &kr : primServer->primaryKeys) {
                         LOG(DEBUG3) << "  Adding primary key range [" << kr.first << ", " << kr.second << "]" << " to " << newPrimary->getName();
-                        newPrimary->primaryKeys.push_back(kr);
+                        newPrimary->addKeyRange(kr);
                     }
-                    open_backup_endpoints(newPrimary, 'b', HB_TIMEOUT*3, &ret);
+                    open_backup_endpoints(newPrimary, 'b', heartbeatTimeoutMs*3, &ret);
                     primaryServers.erase(std::find(primaryServers.begin(), primaryServers.end(), primServer));
                     if (ret == KVCG_ETIMEOUT) {
                       LOG(WARNING) << "Failed getting connection from new primary " << newPrimary->getName();
@@ -500,7 +766,7 @@ ft::Server* ft::Server::handlePrimaryFailure(ft::Server* primServer, ft::Server*
 
 }
 
-int ft::Server::open_backup_endpoints(ft::Server* primServer /* NULL */, char state /*'b'*/, int timeout /* 0 */, int* ret /* NULL */) {
+int ft::Server::open_backup_endpoints(ft::Server* primServer /* NULL */, char state /*'b'*/, int timeoutMs /* 0 */, int* ret /* NULL */) {
     if (primServer == NULL)
         LOG(INFO) << "Opening backup endpoint for other Primaries";
     else {
@@ -522,7 +788,7 @@ int ft::Server::open_backup_endpoints(ft::Server* primServer /* NULL */, char st
         numConns = 1;
     } else {
         // only allow timeout for single node connection
-        assert(timeout == 0);
+        assert(timeoutMs == 0);
     }
     for(i=0; i < numConns; i++) {
         ft::Server* connectedServer;
@@ -538,8 +804,8 @@ int ft::Server::open_backup_endpoints(ft::Server* primServer /* NULL */, char st
           } else if (shutting_down) {
             delete new_conn;
             goto exit;
-          } else if (timeout > 0 && std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - start_time).count() > timeout) {
-            LOG(ERROR) << "Timed out after " << timeout << " seconds waiting for connection from primary " << primServer->getName();
+          } else if (timeoutMs > 0 && std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time).count() > timeoutMs) {
+            LOG(ERROR) << "Timed out after " << timeoutMs << " ms waiting for connection from primary " << primServer->getName();
             status = KVCG_ETIMEOUT;
             delete new_conn;
             goto exit;
@@ -601,7 +867,7 @@ int ft::Server::open_backup_endpoints(ft::Server* primServer /* NULL */, char st
 
                         for (auto const &kr : origPrim->primaryKeys) {
                            LOG(DEBUG3) << "  Adding primary key range [" << kr.first << ", " << kr.second << "]" << " to " << pbackup->getName();
-                           pbackup->primaryKeys.push_back(kr);
+                           pbackup->addKeyRange(kr);
                         }
 
                         // The backup that took over for the original primary now has all the
@@ -669,7 +935,7 @@ int ft::Server::open_backup_endpoints(ft::Server* primServer /* NULL */, char st
         } else {
             // Register memory region for primary to write heartbeat to
             uint64_t heartbeat_key = (uint64_t)boost::hash_value(connectedServer->getName());
-            connectedServer->heartbeat_mr.get()[0] = '-';
+            memset(connectedServer->heartbeat_mr.get(), 0, sizeof(uint64_t));
             LOG(TRACE) << "Registering MRKEY " << heartbeat_key << " for " << connectedServer->getName();
             connectedServer->primary_conn->register_mr(
                     connectedServer->heartbeat_mr,
@@ -685,9 +951,13 @@ int ft::Server::open_backup_endpoints(ft::Server* primServer /* NULL */, char st
                 new_conn->send(buf, sizeof(uint64_t));
             }
 
-            // Register memory region for backup logging
+            // Register memory region for backup logging, starting with an empty ring
             uint64_t logging_mr_key = (uint64_t)boost::hash_value(connectedServer->getName())*2;
-            connectedServer->logging_mr.get()[0] = '\0';
+            if (connectedServer->logging_mr.size() != LOG_RING_SIZE(logSlotSize)) {
+                connectedServer->logging_mr = cse498::unique_buf(LOG_RING_SIZE(logSlotSize));
+            }
+            memset(connectedServer->logging_mr.get(), 0, LOG_RING_SIZE(logSlotSize));
+            connectedServer->logRingNext = 0;
             connectedServer->primary_conn->register_mr(
                     connectedServer->logging_mr,
                     FI_SEND | FI_RECV | FI_WRITE | FI_REMOTE_WRITE | FI_READ | FI_REMOTE_READ,
@@ -701,6 +971,29 @@ int ft::Server::open_backup_endpoints(ft::Server* primServer /* NULL */, char st
                 *((uint64_t*)buf.get()) = (uint64_t)(connectedServer->logging_mr.get());
                 new_conn->send(buf, sizeof(uint64_t));
             }
+
+            // Report what we have of the primary's log stream so it only
+            // restores newer updates, then learn which stream it is sending
+            uint64_t appliedSeq, epoch;
+            connectedServer->logged_putsLock.lock();
+            appliedSeq = connectedServer->logSeq;
+            memcpy(buf.get(), &connectedServer->logEpoch, sizeof(uint64_t));
+            memcpy(buf.get()+sizeof(uint64_t), &appliedSeq, sizeof(uint64_t));
+            new_conn->send(buf, 2*sizeof(uint64_t));
+            new_conn->recv(buf, sizeof(uint64_t));
+            memcpy(&epoch, buf.get(), sizeof(uint64_t));
+            if (epoch != connectedServer->logEpoch) {
+                LOG(DEBUG2) << connectedServer->getName() << " log epoch changed, expecting full restore";
+                connectedServer->logEpoch = epoch;
+                connectedServer->logSeq = 0;
+                // numbers from the old stream say nothing about the new one
+                for (auto &entry : *connectedServer->logged_puts) {
+                    ft::LogArena::seq(entry.second) = 0;
+                }
+            } else {
+                LOG(DEBUG2) << "Expecting " << connectedServer->getName() << " to restore updates after " << appliedSeq;
+            }
+            connectedServer->logged_putsLock.unlock();
         }
 
     }
@@ -712,6 +1005,30 @@ exit:
     return status;
 }
 
+bool ft::Server::writeLogSlot(ft::Server* backup, cse498::unique_buf& buf, size_t len) {
+    // Write one batch into the next free slot of the backup's logging ring.
+    // Only re-read the backup's tail when our cached copy says the ring is full,
+    // so up to LOG_RING_SLOTS batches can be in flight without a round trip.
+    std::unique_lock<std::mutex> lock(backup->logCheckBufLock);
+    while (backup->logRingHead - backup->logRingTailCache >= LOG_RING_SLOTS) {
+        if (shutting_down) {
+            // backup may never free a slot, do not hold up shutdown
+            LOG(WARNING) << "Dropping " << len << " byte log write to " << backup->getName() << ", shutting down";
+            return false;
+        }
+        backup->backup_conn->read(backup->logCheckBuf, sizeof(uint64_t), backup->logging_mr_addr, backup->logging_mr_key);
+        memcpy(&backup->logRingTailCache, backup->logCheckBuf.get(), sizeof(uint64_t));
+    }
+    uint64_t slotOffset = LOG_RING_HDR_SIZE + (backup->logRingHead % LOG_RING_SLOTS)*logSlotSize;
+    FT_LOG(TRACE) << "Writing " << len << " bytes to " << backup->getName() << " slot " << backup->logRingHead << " (tail " << backup->logRingTailCache << ")";
+    backup->backup_conn->write(buf, len, backup->logging_mr_addr + slotOffset, backup->logging_mr_key);
+    trace.record(ft::TRACE_SLOT_WRITE, backup->logRingHead, len);
+    backup->logRingHead++;
+    // doubles as a heartbeat, see heartbeat_loop
+    backup->lastLogWrite = std::chrono::steady_clock::now();
+    return true;
+}
+
 int ft::Server::logRequest(unsigned long long key, data_t* value) {
     std::vector<unsigned long long> keys {key};
     std::vector<data_t*> values {value};
@@ -735,184 +1052,485 @@ int ft::Server::logRequest(std::vector<unsigned long long> keys, std::vector<dat
     return logRequest(batch);
 }
 
-int ft::Server::logRequest(std::vector<RequestWrapper<unsigned long long, data_t *>> batch, std::vector<RequestWrapper<unsigned long long, data_t *>>* failedBatch /* DEFAULT nullptr */) {
-    auto start_time = std::chrono::steady_clock::now();
+int ft::Server::logToBackup(ft::Server* backup, const std::vector<RequestWrapper<unsigned long long, data_t *>>& batch, const std::vector<uint64_t>& seqs, std::vector<bool>& backedUp, std::vector<bool>& invalid) {
+    // Send every request in batch that backup is tracking, marking in
+    // backedUp each request that was written to it, and in invalid each
+    // request that can never be logged
     int status = KVCG_ESUCCESS;
-    bool backedUp[batch.size()] = { 0 };
-    int logBufSize = 4096;
-    int backedUpOffset, idx, offset;
-    std::bitset<255> skippedBitmask;
-    uint8_t numLogs = 0;
+    std::vector<size_t> pending; // requests in the batch being built
+    bool compress = false;       // batch has a key in a compressed range
+
+    std::unique_lock<std::mutex> lock(backup->logDataBufLock);
+    ft::LogBatchWriter writer(backup->logDataBuf.get(), logSlotSize, logSlotEntries);
+    writer.setBaseSeq(backup->logSentSeq);
+
+    auto send = [&]() {
+        // After a batch that did not compress, send the next few as is
+        // rather than spend time compressing data that likely will not
+        char* scratch = nullptr;
+        if (compress) {
+            if (backup->compressSkip > 0) {
+                backup->compressSkip--;
+            } else {
+                backup->compressBuf.resize(logSlotSize);
+                scratch = backup->compressBuf.data();
+            }
+        }
+        size_t len = writer.finish(scratch);
+        if (scratch != nullptr && !writer.isCompressed()) {
+            backup->compressSkip = LOG_COMPRESS_BACKOFF;
+        }
+        FT_LOG(DEBUG3) << "Sending " << writer.size() << " logs (" << len << " bytes" << (writer.isCompressed() ? ", compressed" : "") << ") to " << backup->getName();
+        if (writeLogSlot(backup, backup->logDataBuf, len)) {
+            if (writer.getSeq() != 0) {
+                backup->logSentSeq = writer.getSeq();
+            }
+            for (auto j : pending) {
+                FT_LOG(DEBUG4) << "Marking key[" << j << "] for backup " << backup->getName();
+                backedUp[j] = true;
+            }
+        }
+        pending.clear();
+        compress = false;
+        writer.reset();
+        writer.setBaseSeq(backup->logSentSeq);
+    };
+
+    for (size_t idx = 0; idx < batch.size(); idx++) {
+        auto &req = batch[idx];
+
+        if (req.requestInteger != REQUEST_INSERT && req.requestInteger != REQUEST_REMOVE) {
+            FT_LOG(DEBUG2) << "Skipping read request (" << req.requestInteger << ")";
+            backedUp[idx] = true;
+            continue;
+        }
+
+        if(!backup->isBackup(req.key)) {
+            FT_LOG(DEBUG2) << "Skipping backup to server " << backup->getName() << " not tracking key " << req.key;
+            continue;
+        }
+        if (req.value != nullptr && req.value->size > maxValueSize) {
+            LOG(ERROR) << "Can not log key " << req.key << ", " << req.value->size << " bytes is over maxValueSize " << maxValueSize;
+            invalid[idx] = true;
+            status = KVCG_EINVALID;
+            continue;
+        }
+        if (req.requestInteger == REQUEST_INSERT) {
+          FT_LOG(INFO) << "Logging to " << backup->getName() << ":  INSERT (" << req.key << "): " << std::string(req.value->data, req.value->size);
+        } else {
+          FT_LOG(INFO) << "Logging to " << backup->getName() << ":  REMOVE (" << req.key << "): " << std::string(req.value->data, req.value->size);
+        }
+
+        // Chunks of a large value each get a slot of their own, so the
+        // range has to be known before the first of them is sent
+        bool compressKey = shouldCompress(req.key);
+        if (!writer.append(req, seqs[idx])) {
+            if (!writer.empty()) {
+                // Filled buffer; send what we have and start the next
+                FT_LOG(DEBUG3) << "Filled buffer to " << backup->getName();
+                send();
+            }
+            if (!writer.append(req, seqs[idx])) {
+                // Larger than a slot, split the value over as many as it
+                // takes. The backup applies it once every chunk is in.
+                FT_LOG(DEBUG3) << "Sending key " << req.key << " (" << req.value->size << " bytes) to " << backup->getName() << " in chunks";
+                size_t offset = 0;
+                while (offset < req.value->size) {
+                    size_t n = writer.appendChunk(req, offset, seqs[idx]);
+                    if (n == 0) {
+                        break;
+                    }
+                    offset += n;
+                    if (offset < req.value->size) {
+                        compress = compressKey;
+                        send();
+                    }
+                }
+                if (offset < req.value->size) {
+                    LOG(ERROR) << "Can not log key " << req.key << ", data too large!";
+                    invalid[idx] = true;
+                    status = KVCG_EINVALID;
+                    continue;
+                }
+            }
+        }
+        pending.push_back(idx);
+        compress = compress || compressKey;
+        trace.record(ft::TRACE_LOG_SEND, req.key, seqs[idx]);
+    }
+    if (!writer.empty()) {
+        send();
+    }
+
+    return status;
+}
+
+int ft::Server::logRequest(std::vector<RequestWrapper<unsigned long long, data_t *>> batch, std::vector<RequestWrapper<unsigned long long, data_t *>>* failedBatch /* DEFAULT nullptr */, ft::AckPolicy ackPolicy /* DEFAULT ACK_DEFAULT */) {
+    auto start_time = std::chrono::steady_clock::now();
+    LogGroupRequest req;
+    req.batch = &batch;
+    req.failedBatch = failedBatch;
+    req.ackPolicy = ackPolicy;
+
+    // Queue up behind any group already being sent. Whoever finds no
+    // leader takes everything queued so far and sends it as one group,
+    // so concurrent callers share ring writes instead of taking turns.
+    std::unique_lock<std::mutex> lock(logGroupLock);
+    logGroupQueue.push_back(&req);
+    while (!req.done) {
+        if (logGroupLeader) {
+            logGroupCv.wait(lock);
+            continue;
+        }
+        leadLogGroup(lock);
+    }
+    lock.unlock();
+
+    int runtime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time).count();
+    FT_LOG(DEBUG) << "time: " << runtime << "us, Exit (" << req.status << "): " << kvcg_strerror(req.status);
+    return req.status;
+}
+
+void ft::Server::logRequestAsync(std::vector<RequestWrapper<unsigned long long, data_t *>> batch, std::function<void(int, std::vector<RequestWrapper<unsigned long long, data_t *>>&)> callback, ft::AckPolicy ackPolicy /* DEFAULT ACK_DEFAULT */) {
+    LogGroupRequest* req = new LogGroupRequest();
+    req->ownedBatch = std::move(batch);
+    req->batch = &req->ownedBatch;
+    req->failedBatch = &req->ownedFailedBatch;
+    req->callback = callback;
+    req->ackPolicy = ackPolicy;
+
+    // Picked up by the next group, log_ship leads one if nobody else is
+    std::unique_lock<std::mutex> lock(logGroupLock);
+    logGroupQueue.push_back(req);
+    logGroupCv.notify_all();
+}
+
+std::future<int> ft::Server::logRequestAsync(std::vector<RequestWrapper<unsigned long long, data_t *>> batch, std::vector<RequestWrapper<unsigned long long, data_t *>>* failedBatch /* DEFAULT nullptr */, ft::AckPolicy ackPolicy /* DEFAULT ACK_DEFAULT */) {
+    auto promise = std::make_shared<std::promise<int>>();
+    std::future<int> result = promise->get_future();
+    logRequestAsync(std::move(batch), [promise, failedBatch](int status, std::vector<RequestWrapper<unsigned long long, data_t *>>& failed) {
+        if (failedBatch != nullptr) {
+            failedBatch->insert(failedBatch->end(), failed.begin(), failed.end());
+        }
+        promise->set_value(status);
+    }, ackPolicy);
+    return result;
+}
+
+void ft::Server::leadLogGroup(std::unique_lock<std::mutex>& lock) {
+    // Called holding logGroupLock with no leader. Send everything queued
+    // so far as one group, then release its callers.
+    logGroupLeader = true;
+    std::vector<LogGroupRequest*> group;
+    group.swap(logGroupQueue);
+    lock.unlock();
+
+    FT_LOG(DEBUG3) << "Leading log group of " << group.size() << " requests";
+    commitLogGroup(group);
+
+    // Complete async requests, nobody is waiting on them
+    for (auto r : group) {
+        if (r->callback) {
+            r->callback(r->status, r->ownedFailedBatch);
+        }
+    }
+
+    lock.lock();
+    for (auto r : group) {
+        if (r->callback) {
+            delete r;
+        } else {
+            r->done = true;
+        }
+    }
+    logGroupLeader = false;
+    logGroupCv.notify_all();
+}
+
+void ft::Server::log_ship() {
+    // Lead groups for async requests when no synchronous caller is
+    // around to do it
+    std::unique_lock<std::mutex> lock(logGroupLock);
+    while (true) {
+        logGroupCv.wait(lock, [this]() { return !logGroupLeader && (logShipStop || !logGroupQueue.empty()); });
+        if (logGroupQueue.empty()) {
+            // stopped, nothing left to send
+            return;
+        }
+        leadLogGroup(lock);
+    }
+}
+
+ft::AckPolicy ft::Server::getAckPolicy(unsigned long long key) {
+    // ackPolicies is sorted and does not overlap, check the last range
+    // starting at or below key
+    auto it = std::upper_bound(ackPolicies.begin(), ackPolicies.end(), key,
+        [](unsigned long long k, const std::pair<std::pair<unsigned long long, unsigned long long>, ft::AckPolicy>& p) {
+            return k < p.first.first;
+        });
+    if (it == ackPolicies.begin() || key > (it-1)->first.second) {
+        return ft::ACK_ALL;
+    }
+    return (it-1)->second;
+}
+
+void ft::Server::setAckPolicies(std::vector<std::pair<std::pair<unsigned long long, unsigned long long>, ft::AckPolicy>> policies) {
+    std::sort(policies.begin(), policies.end());
+    ackPolicies = policies;
+}
+
+bool ft::Server::shouldCompress(unsigned long long key) {
+    // compressRanges is sorted and does not overlap, check the last range
+    // starting at or below key
+    auto it = std::upper_bound(compressRanges.begin(), compressRanges.end(), key,
+        [](unsigned long long k, const std::pair<unsigned long long, unsigned long long>& r) {
+            return k < r.first;
+        });
+    return it != compressRanges.begin() && key <= (it-1)->second;
+}
+
+void ft::Server::setCompressRanges(std::vector<std::pair<unsigned long long, unsigned long long>> ranges) {
+    std::sort(ranges.begin(), ranges.end());
+    compressRanges = ranges;
+}
+
+void ft::Server::waitLogTicket(ft::Server* backup, uint64_t ticket) {
+    std::unique_lock<std::mutex> lock(backup->logOrderLock);
+    backup->logOrderCv.wait(lock, [&]() { return backup->logTicketServing == ticket; });
+}
+
+void ft::Server::doneLogTicket(ft::Server* backup) {
+    std::unique_lock<std::mutex> lock(backup->logOrderLock);
+    backup->logTicketServing++;
+    backup->logOrderCv.notify_all();
+}
+
+void ft::Server::pauseLogGroups() {
+    std::unique_lock<std::mutex> lock(logGroupLock);
+    logGroupCv.wait(lock, [this]() { return !logGroupLeader; });
+    logGroupLeader = true;
+}
+
+void ft::Server::resumeLogGroups() {
+    std::unique_lock<std::mutex> lock(logGroupLock);
+    logGroupLeader = false;
+    logGroupCv.notify_all();
+}
+
+void ft::Server::shipToBackup(std::shared_ptr<LogShipment> ship, ft::Server* backup, uint64_t ticket, int i) {
+    // Wait for earlier groups to this backup to be written first
+    waitLogTicket(backup, ticket);
+    logToBackup(backup, ship->batch, ship->seqs, ship->marks[i], ship->invalid[i]);
+    doneLogTicket(backup);
+
+    std::unique_lock<std::mutex> lock(ship->lock);
+    for (int idx=0; idx < ship->batch.size(); idx++) {
+        if (ship->marks[i][idx]) {
+            ship->acks[idx]++;
+        }
+        if (ship->invalid[i][idx]) {
+            ship->anyInvalid[idx] = true;
+        }
+    }
+    ship->sendersLeft--;
+    ship->cv.notify_all();
+}
+
+void ft::Server::commitLogGroup(std::vector<LogGroupRequest*>& group) {
+    // Send every request in group to the backups together, then set
+    // each caller's status and failedBatch as if it was sent alone.
+    auto ship = std::make_shared<LogShipment>();
+    std::vector<ft::Server*> liveBackups;
+    std::vector<int> trackers; // live backups that should get each request
+    std::vector<int> need;     // acks needed before the request's caller is released
+    bool waitAll = true;
+    int idx;
 
-    // TODO: Make parallel
     for (auto backup : backupServers) {
         // TBD: What happens if a backup died during backup process?
         if (!backup->alive) {
-            LOG(DEBUG2) << "Skipping backup to down server " << backup->getName();
+            FT_LOG(DEBUG2) << "Skipping backup to down server " << backup->getName();
             continue;
         }
-        std::unique_lock<std::mutex> lock(backup->logDataBufLock);
-        backup->logDataBuf.get()[0] = 'l'; // first byte indicate packet type - 'l'=log
-        backup->logDataBuf.get()[1] = '1'; // will indicate number of requests per write
-
-        idx = -1;
-        numLogs = 0;
-        backedUpOffset = 0;
-        skippedBitmask = 0;
-        offset = 0;
-        for (auto req : batch) {
-            idx++;
+        liveBackups.push_back(backup);
+    }
 
-            if (req.requestInteger != REQUEST_INSERT && req.requestInteger != REQUEST_REMOVE) {
-                LOG(DEBUG2) << "Skipping read request (" << req.requestInteger << ")";
-                backedUpOffset++;
-                goto checklogend;
+    for (auto r : group) {
+        for (auto &req : *r->batch) {
+            ft::AckPolicy policy = r->ackPolicy;
+            if (policy == ft::ACK_DEFAULT) {
+                policy = getAckPolicy(req.key);
             }
-
-            if(!backup->isBackup(req.key)) {
-                LOG(DEBUG2) << "Skipping backup to server " << backup->getName() << " not tracking key " << req.key;
-                skippedBitmask[backedUpOffset] = 1;
-                backedUpOffset++;
-                goto checklogend;
+            int count = 0;
+            for (auto backup : liveBackups) {
+                // reads are marked by every backup
+                if ((req.requestInteger != REQUEST_INSERT && req.requestInteger != REQUEST_REMOVE) || backup->isBackup(req.key)) {
+                    count++;
+                }
+            }
+            trackers.push_back(count);
+            switch (policy) {
+              case ft::ACK_QUORUM:
+                need.push_back(count > 0 ? count/2 + 1 : 0);
+                break;
+              case ft::ACK_ONE:
+                need.push_back(count > 0 ? 1 : 0);
+                break;
+              case ft::ACK_ASYNC:
+                need.push_back(0);
+                break;
+              default:
+                need.push_back(count);
             }
-            if (req.requestInteger == REQUEST_INSERT) {
-              LOG(INFO) << "Logging to " << backup->getName() << ":  INSERT (" << req.key << "): " << req.value->data;
+            if (policy != ft::ACK_ALL && policy != ft::ACK_DEFAULT) {
+                waitAll = false;
+            }
+            ship->batch.push_back(req);
+            // Number updates in the order backups will receive them
+            if (req.requestInteger == REQUEST_INSERT || req.requestInteger == REQUEST_REMOVE) {
+                ship->seqs.push_back(++logSeq);
             } else {
-              LOG(INFO) << "Logging to " << backup->getName() << ":  REMOVE (" << req.key << "): " << req.value->data;
+                ship->seqs.push_back(0);
             }
+        }
+    }
 
-            size_t dataSize;
-            try {
-                dataSize = serialize2(backup->logDataBuf.get()+2+offset, logBufSize-2-offset, req);
-                if (offset + 2 + dataSize >= logBufSize) {
-                    // serialize2 should've raise an exception, force it
-                    throw std::overflow_error("MR buffer filled");
-                }
-            } catch (const std::overflow_error& e) {
-                if (offset == 0) {
-                    LOG(ERROR) << "Can not log key " << req.key << ", data too large!";
-                    skippedBitmask[backedUpOffset] = 1;
-                    backedUpOffset++;
-                    status = KVCG_EINVALID;
-                    goto checklogend;
-                }
+    if (!waitAll) {
+        // Callers may be released and free their values before every
+        // backup has been written, so send copies
+        ship->valueData.resize(ship->batch.size());
+        for (idx=0; idx < ship->batch.size(); idx++) {
+            data_t* value = ship->batch[idx].value;
+            if (value == nullptr) continue;
+            ship->values.emplace_back(new char[value->size]);
+            memcpy(ship->values.back().get(), value->data, value->size);
+            ship->valueData[idx].size = value->size;
+            ship->valueData[idx].data = ship->values.back().get();
+            ship->batch[idx].value = &ship->valueData[idx];
+        }
+    }
 
-                // Filled buffer; send what we have and prepare for next
-                LOG(DEBUG3)<< "Filled buffer to " << backup->getName() << ", sending " << (unsigned)numLogs << " logs (" << offset << "+2 bytes)";
-                backup->logCheckBufLock.lock();
-                do {
-                  backup->backup_conn->read(backup->logCheckBuf, 1, backup->logging_mr_addr, backup->logging_mr_key);
-                } while (backup->logCheckBuf.get()[0] != '\0');
-                backup->logDataBuf.get()[1] = numLogs;
-                backup->backup_conn->write(backup->logDataBuf, offset+2, backup->logging_mr_addr, backup->logging_mr_key);
-                backup->logCheckBufLock.unlock();
-                // mark that these were backed up
-                for (int j=(idx-backedUpOffset); j<=idx-1; j++) {
-                  LOG(TRACE) << "Setting mark on key[" << j << "]. skippedBitmask=" << skippedBitmask << ", idx=" << idx << ", backedUpOffset=" << backedUpOffset;
-                  if (skippedBitmask[j-(idx-backedUpOffset)] == 1) {
-                      LOG(DEBUG4) << "Skip marking key[" << j << "] for backup " << backup->getName();
-                  } else {
-                      LOG(DEBUG4) << "Marking key[" << j << "] for backup " << backup->getName();
-                      backedUp[j] = true;
-                  }
-                }
+    ship->marks.assign(liveBackups.size(), std::vector<bool>(ship->batch.size(), false));
+    ship->invalid.assign(liveBackups.size(), std::vector<bool>(ship->batch.size(), false));
+    ship->acks.assign(ship->batch.size(), 0);
+    ship->anyInvalid.assign(ship->batch.size(), false);
+    ship->sendersLeft = liveBackups.size();
 
-                // Load up for next key
-                offset = 0;
-                numLogs = 0;
-                backedUpOffset = 0;
-                skippedBitmask = 0;
-                try {
-                  dataSize = serialize2(backup->logDataBuf.get()+2+offset, logBufSize-2-offset, req);
-                  if (offset + 2 + dataSize >= logBufSize) {
-                    // serialize2 should've raise an exception, force it
-                    throw std::overflow_error("MR buffer filled");
-                  }
-                } catch (const std::overflow_error& e) {
-                  LOG(ERROR) << "Can not log key " << req.key << ", data too large!";
-                  status = KVCG_EINVALID;
-                  skippedBitmask[backedUpOffset] = 1;
-                  backedUpOffset++;
-                  goto checklogend;
-                }
+    std::vector<uint64_t> tickets;
+    for (auto backup : liveBackups) {
+        std::unique_lock<std::mutex> lock(backup->logOrderLock);
+        tickets.push_back(backup->logTicketNext++);
+    }
+
+    bool sequential = waitAll && (!parallelLogging || liveBackups.size() <= 1);
+    if (sequential) {
+        for (int i=0; i < liveBackups.size(); i++) {
+            shipToBackup(ship, liveBackups[i], tickets[i], i);
+        }
+    } else {
+        // Send to all backups at once. If we wait for all of them anyway
+        // use this thread for the first, otherwise senders run on until
+        // every backup has the group, after the callers are released.
+        int first = waitAll ? 1 : 0;
+        for (int i=first; i < liveBackups.size(); i++) {
+            {
+                std::unique_lock<std::mutex> lock(shipLock);
+                shipsInFlight++;
             }
+            std::thread([this, ship, backup = liveBackups[i], ticket = tickets[i], i]() {
+                shipToBackup(ship, backup, ticket, i);
+                // Wake shutdown only once this thread is done with us
+                std::unique_lock<std::mutex> lock(shipLock);
+                shipsInFlight--;
+                std::notify_all_at_thread_exit(shipCv, std::move(lock));
+            }).detach();
+        }
+    }
 
-            LOG(DEBUG2) << "raw data: " << (void*) (backup->logDataBuf.get()+2+offset);
-            LOG(DEBUG2) << "data size: " << dataSize << ", current offset: " << offset;
-
-            offset += dataSize;
-            numLogs++;
-            backedUpOffset++;
-
-checklogend:
-            if (numLogs > 254 || idx == batch.size()-1) {
-                LOG(DEBUG3) << "Sending " << (unsigned)numLogs << " logs (" << offset << "+2 bytes) to " << backup->getName();
-                // Either at the end of the KV pairs, or max number of logs per send
-                // (only 1 byte reserved for numLogs, max 255).
-                backup->logCheckBufLock.lock();
-                do {
-                    backup->backup_conn->read(backup->logCheckBuf, 1, backup->logging_mr_addr, backup->logging_mr_key);
-                } while (backup->logCheckBuf.get()[0] != '\0');
-                backup->logDataBuf.get()[1] = numLogs;
-                backup->backup_conn->write(backup->logDataBuf, offset+2, backup->logging_mr_addr, backup->logging_mr_key);
-                backup->logCheckBufLock.unlock();
-                // mark that these were backed up
-                for (int j=(idx-(backedUpOffset-1)); j<=idx; j++) {
-                  LOG(TRACE) << "Setting mark on key[" << j << "]. skippedBitmask=" << skippedBitmask << ", idx=" << idx << ", backedUpOffset=" << backedUpOffset;
-                  if (skippedBitmask[j-(idx-(backedUpOffset-1))] == 1) {
-                      LOG(DEBUG4) << "Skip marking key[" << j << "] for backup " << backup->getName();
-                  } else {
-                      LOG(DEBUG4) << "Marking key[" << j << "] for backup " << backup->getName();
-                      backedUp[j] = true;
-                  }
-                }
-                // clear out for next key
-                offset = 0;
-                numLogs = 0;
-                backedUpOffset = 0;
-                skippedBitmask = 0;
+    if (!sequential && waitAll && liveBackups.size() > 0) {
+        shipToBackup(ship, liveBackups[0], tickets[0], 0);
+    }
+
+    // Wait until every request has the acks its policy needs
+    std::vector<bool> backedUp(ship->batch.size(), false);
+    std::vector<bool> invalid(ship->batch.size(), false);
+    {
+        std::unique_lock<std::mutex> lock(ship->lock);
+        ship->cv.wait(lock, [&]() {
+            if (ship->sendersLeft == 0) return true;
+            for (int j=0; j < need.size(); j++) {
+                if (ship->acks[j] < need[j]) return false;
+            }
+            return true;
+        });
+        for (idx=0; idx < ship->batch.size(); idx++) {
+            // An async request is as good as sent once a backup tracks it
+            backedUp[idx] = ship->acks[idx] > 0 || (need[idx] == 0 && trackers[idx] > 0);
+            invalid[idx] = ship->anyInvalid[idx];
+        }
+    }
+
+    // Make the group durable locally, only the requests that were backed
+    // up so a restart does not bring back ones the callers were told
+    // failed. The whole group shares one sync.
+    if (wal.isOpen()) {
+        std::vector<RequestWrapper<unsigned long long, data_t *>> walBatch;
+        for (idx=0; idx < ship->batch.size(); idx++) {
+            if (backedUp[idx] && isPrimary(ship->batch[idx].key)) {
+                walBatch.push_back(ship->batch[idx]);
             }
         }
+        int walStatus = walBatch.empty() ? KVCG_ESUCCESS : wal.append(walBatch);
+        if (walStatus) {
+            LOG(ERROR) << "Failed to append log group to write-ahead log (" << walStatus << ")";
+            // not durable here, let the caller retry
+            backedUp.assign(backedUp.size(), false);
+        }
     }
 
-    // set return code and update internal logging record
+    // set return codes and update internal logging record
     // TBD: What if some keys succeeded and others failed? For
     //      now we return an error, but still logged the successful ones.
     this->logged_putsLock.lock();
-    for (idx=0; idx < batch.size(); idx++) {
-        if (!backedUp[idx]) {
-            LOG(ERROR) << "Failed to log key - " << batch.at(idx).key;
-            if(failedBatch != nullptr) {
-                LOG(DEBUG2) << "Adding failed entry to failedBatch";
-                failedBatch->push_back(batch.at(idx));
+    idx = 0;
+    for (auto r : group) {
+        int status = KVCG_ESUCCESS;
+        for (int j=idx; j < idx+r->batch->size(); j++) {
+            if (invalid[j]) {
+                // data too large for any backup
+                status = KVCG_EINVALID;
             }
-            if(!status || status == KVCG_EUNAVAILABLE) {
-                // If the server tried to log a key that we are not the primary for,
-                // return status should be INVALID, so the caller does not retry.
-                // isPrimary requires locking, so only call if we have to.
-                if (!isPrimary(batch.at(idx).key)) {
-                    LOG(DEBUG2) << "Not primary for key - " << batch.at(idx).key;
-                    status = KVCG_EINVALID;
-                } else {
-                    status = KVCG_EUNAVAILABLE;
+        }
+
+        for (auto &req : *r->batch) {
+            if (!backedUp[idx]) {
+                LOG(ERROR) << "Failed to log key - " << req.key;
+                if(r->failedBatch != nullptr) {
+                    FT_LOG(DEBUG2) << "Adding failed entry to failedBatch";
+                    r->failedBatch->push_back(req);
                 }
+                if(!status || status == KVCG_EUNAVAILABLE) {
+                    // If the server tried to log a key that we are not the primary for,
+                    // return status should be INVALID, so the caller does not retry.
+                    if (!isPrimary(req.key)) {
+                        FT_LOG(DEBUG2) << "Not primary for key - " << req.key;
+                        status = KVCG_EINVALID;
+                    } else {
+                        status = KVCG_EUNAVAILABLE;
+                    }
+                }
+            } else {
+                // track that we logged this so it can be restored if a backup fails
+                FT_LOG(DEBUG4) << "Replacing log entry for self key " << req.key << ": " << std::string(req.value->data, req.value->size);
+                setLogEntry(req.key, req.requestInteger, req.value, ship->seqs[idx]);
             }
-        } else {
-            // track that we logged this so it can be restored if a backup fails
-            auto elem = this->logged_puts->find(batch.at(idx).key);
-            LOG(DEBUG4) << "Replacing log entry for self key " << batch.at(idx).key << ": " << elem->second->value->data << "->" << batch.at(idx).value->data;
-            elem->second->value->size = batch.at(idx).value->size;
-            elem->second->requestInteger = batch.at(idx).requestInteger;
-            memcpy(elem->second->value->data, batch.at(idx).value->data, elem->second->value->size);
+            idx++;
         }
+        r->status = status;
     }
     traceLogRecord();
     this->logged_putsLock.unlock();
-
-exit:
-    int runtime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time).count();
-    LOG(DEBUG) << "time: " << runtime << "us, Exit (" << status << "): " << kvcg_strerror(status);
-    return status;
+    trace.record(ft::TRACE_GROUP_COMMIT, group.size(), ship->batch.size());
 }
 
 int ft::Server::connect_backups(ft::Server* newBackup /* defaults NULL */, bool waitForDead /* defaults false */ ) {
@@ -929,6 +1547,7 @@ int ft::Server::connect_backups(ft::Server* newBackup /* defaults NULL */, bool
     bool updated = false;
 
     std::vector<ft::Server*> connectToServers;
+    std::vector<ft::Server*> connected; // finished the handshake as our backup
     if (newBackup != NULL) {
         connectToServers.push_back(newBackup);
     } else {
@@ -940,6 +1559,9 @@ int ft::Server::connect_backups(ft::Server* newBackup /* defaults NULL */, bool
             continue;
         }
 
+        // Not sent to until its logging ring is set up below
+        backup->alive = false;
+
         // accept byte
         buf.get()[0] = 'n';
 
@@ -971,8 +1593,6 @@ int ft::Server::connect_backups(ft::Server* newBackup /* defaults NULL */, bool
           }
         }
 
-        backup->alive = true;
-
         LOG(DEBUG2) << "    Connection established, sending checksum";
 
         // backup should reply with config checksum and its state
@@ -1001,6 +1621,7 @@ int ft::Server::connect_backups(ft::Server* newBackup /* defaults NULL */, bool
             // Backup took over at some point. Become a backup to it now.
             // TODO: Verify only one backup server responds with this
             LOG(INFO) << "Backup Server " << backup->getName() << " took over as primary";
+            backup->alive = true;
 
             // Tell any previous backups who we already exchanged with that we were wrong and someone
             // else is primary
@@ -1009,11 +1630,13 @@ int ft::Server::connect_backups(ft::Server* newBackup /* defaults NULL */, bool
                     break;
                 }
                 LOG(DEBUG) << "Informing " << backup->getName() << " of new primary";
-                buf.get()[0] = '0';
-                b->backup_conn->write(buf, 1, b->heartbeat_addr, b->heartbeat_key);
+                // any non-zero heartbeat gets it reading its log ring
+                uint64_t beat = 1;
+                memcpy(buf.get(), &beat, sizeof(uint64_t));
+                b->backup_conn->write(buf, sizeof(uint64_t), b->heartbeat_addr, b->heartbeat_key);
                 buf.get()[0] = 'p';
                 buf.cpyTo(backup->getName().c_str() + '\0', backup->getName().size()+1, 1);
-                b->backup_conn->write(buf, 1+backup->getName().size(), b->logging_mr_addr, b->logging_mr_key);
+                writeLogSlot(b, buf, 1+backup->getName().size()+1);
             }
 
             // See if we already are backing this server up on other keys
@@ -1026,9 +1649,10 @@ int ft::Server::connect_backups(ft::Server* newBackup /* defaults NULL */, bool
                     for (auto const &kr : primaryKeys) {
                         p->addKeyRange(kr);
                         // Also remove our key range from the list of keys the new primary is backing up
-                        p->backupKeys.erase(std::remove(p->backupKeys.begin(), p->backupKeys.end(), kr), p->backupKeys.end());
+                        p->removeBackupKeyRange(kr);
                     }
                     primaryKeys.clear();
+                    publishPrimaryKeys();
                     primaryKeysLock.unlock();
                     alreadyBacking = true;
                     break;
@@ -1042,11 +1666,12 @@ int ft::Server::connect_backups(ft::Server* newBackup /* defaults NULL */, bool
                 // If this server is also configured as a primary for other keys
                 // that we are not backing up, clear them so we do not try to
                 // take ownership of them on failover
-                backup->primaryKeys.clear();
+                backup->setKeyRanges({});
                 primaryKeysLock.lock();
                 for (auto const &kr : primaryKeys)
                     backup->addKeyRange(kr);
                 primaryKeys.clear();
+                publishPrimaryKeys();
                 primaryKeysLock.unlock();
                 open_backup_endpoints(backup, 'b', 0, nullptr);
             }
@@ -1062,6 +1687,7 @@ int ft::Server::connect_backups(ft::Server* newBackup /* defaults NULL */, bool
             }
             // Not a primary anymore, nobody backing this server up.
             clearBackupServers();
+            connected.clear();
             break;
         } else if (o_state != 'b') {
             LOG(ERROR) << "Could not determine state of " << backup->getName() << " - " << o_state;
@@ -1088,6 +1714,24 @@ int ft::Server::connect_backups(ft::Server* newBackup /* defaults NULL */, bool
                 backup->backup_conn->recv(buf, sizeof(uint64_t));
                 backup->logging_mr_addr = *((uint64_t *)buf.get());
             }
+
+            // Backup reports what it has of our log stream, reply with our epoch
+            backup->backup_conn->recv(buf, 2*sizeof(uint64_t));
+            memcpy(&backup->remoteLogEpoch, buf.get(), sizeof(uint64_t));
+            memcpy(&backup->remoteLogSeq, buf.get()+sizeof(uint64_t), sizeof(uint64_t));
+            memcpy(buf.get(), &this->logEpoch, sizeof(uint64_t));
+            backup->backup_conn->send(buf, sizeof(uint64_t));
+
+            // Backup starts with an empty logging ring. Reset under the
+            // locks senders take, so no write in flight lands in a slot
+            // the new ring has not freed.
+            {
+                std::lock_guard<std::mutex> dataLock(backup->logDataBufLock);
+                std::lock_guard<std::mutex> checkLock(backup->logCheckBufLock);
+                backup->logRingHead = 0;
+                backup->logRingTailCache = 0;
+            }
+            connected.push_back(backup);
         }
 
     }
@@ -1099,16 +1743,13 @@ int ft::Server::connect_backups(ft::Server* newBackup /* defaults NULL */, bool
     }
 
     /* Start updating heartbeat on backups */
-    for (auto &backup: backupServers) {
-        if (newBackup != NULL && newBackup->getName() != backup->getName()) {
-            continue;
-        }
-        if (!backup->alive) {
-            continue;
-        }
-
+    for (auto &backup: connected) {
         LOG(DEBUG) << "Starting heartbeat to " << backup->getName();
-        heartbeat_threads.push_back(new std::thread(&ft::Server::beat_heart, this, backup));
+        backup->backup_conn->register_mr(
+                    backup->heartbeatSendBuf,
+                    FI_SEND | FI_RECV | FI_WRITE | FI_REMOTE_WRITE | FI_READ | FI_REMOTE_READ,
+                    backup->heartbeatSendBufKey);
+        startHeartbeat(backup);
 
         // Set up logging memory regions
         backup->backup_conn->register_mr(
@@ -1116,6 +1757,11 @@ int ft::Server::connect_backups(ft::Server* newBackup /* defaults NULL */, bool
                     FI_SEND | FI_RECV | FI_WRITE | FI_REMOTE_WRITE | FI_READ | FI_REMOTE_READ,
                     backup->logCheckBufKey);
 
+        backup->logDataBufLock.lock();
+        if (backup->logDataBuf.size() != logSlotSize) {
+            backup->logDataBuf = cse498::unique_buf(logSlotSize);
+        }
+        backup->logDataBufLock.unlock();
         backup->backup_conn->register_mr(
                     backup->logDataBuf,
                     FI_SEND | FI_RECV | FI_WRITE | FI_REMOTE_WRITE | FI_READ | FI_REMOTE_READ,
@@ -1125,22 +1771,68 @@ int ft::Server::connect_backups(ft::Server* newBackup /* defaults NULL */, bool
         // In the case that our backup failed and came back online, or we took
         // over as primary and the old primary is back as a backup to us, we need
         // to send all transactions that have happened to the recovered server.
-        LOG(DEBUG) << "Restoring logs to " << backup->getName();
+        // If it is still on our current log stream, it only needs what it missed.
+        //
+        // With no group being committed, mark it alive and take its next
+        // ticket. Every group committed before is in the log history sent
+        // here, every group after includes it and is written after the
+        // restore. Holding logged_putsLock keeps the restored values from
+        // changing under us until they are written.
+        uint64_t ticket;
+        pauseLogGroups();
+        {
+            std::unique_lock<std::mutex> lock(backup->logOrderLock);
+            ticket = backup->logTicketNext++;
+        }
+        backup->alive = true;
         this->logged_putsLock.lock();
-        for (auto it = logged_puts->begin(); it != logged_puts->end(); ++it) {
-            if(it->second->value->data[0] != '\0' && backup->isBackup(it->first)) {
-                LOG(DEBUG) << "Sending (" << it->second->key << "," << it->second->value->data << ") to " << backup->getName();
-                do {
-                  backup->backup_conn->read(buf, 1, backup->logging_mr_addr, backup->logging_mr_key);
-                } while (buf.get()[0] != '\0');
-                buf.get()[0] = 'l';
-                buf.get()[1] = 1;
-                size_t dataSize = serialize2(buf.get()+2, MAX_LOG_SIZE, *it->second);
-                backup->backup_conn->write(buf,
-                                           dataSize+2, backup->logging_mr_addr, backup->logging_mr_key);
+        resumeLogGroups();
+        waitLogTicket(backup, ticket);
+        {
+            bool incremental = (backup->remoteLogEpoch == this->logEpoch);
+            {
+                // First batch follows on from what the backup reported having
+                std::lock_guard<std::mutex> dataLock(backup->logDataBufLock);
+                backup->logSentSeq = incremental ? backup->remoteLogSeq : 0;
+            }
+            std::vector<RequestWrapper<unsigned long long, data_t*>*> restore;
+            for (auto it = logged_puts->begin(); it != logged_puts->end(); ++it) {
+                if (backup->isBackup(it->first) && (!incremental || ft::LogArena::seq(it->second) > backup->remoteLogSeq)) {
+                    restore.push_back(it->second);
+                }
+            }
+            // Oldest first, so a backup failing part way through still has a prefix of our stream
+            std::sort(restore.begin(), restore.end(), [](RequestWrapper<unsigned long long, data_t*>* a, RequestWrapper<unsigned long long, data_t*>* b) {
+                return ft::LogArena::seq(a) < ft::LogArena::seq(b);
+            });
+            if (incremental) {
+                LOG(DEBUG) << "Restoring " << restore.size() << " logs after " << backup->remoteLogSeq << " to " << backup->getName();
+            } else {
+                LOG(DEBUG) << "Restoring all " << restore.size() << " logs to " << backup->getName();
+            }
+
+            // Send them the same way as logged requests, packing as many
+            // entries as fit into each log slot write
+            std::vector<RequestWrapper<unsigned long long, data_t*>> restoreBatch;
+            std::vector<uint64_t> restoreSeqs;
+            restoreBatch.reserve(restore.size());
+            restoreSeqs.reserve(restore.size());
+            for (auto entry : restore) {
+                restoreBatch.push_back(*entry);
+                restoreSeqs.push_back(ft::LogArena::seq(entry));
+            }
+            if (!restoreBatch.empty()) {
+                std::vector<bool> restored(restoreBatch.size(), false);
+                std::vector<bool> invalid(restoreBatch.size(), false);
+                logToBackup(backup, restoreBatch, restoreSeqs, restored, invalid);
+                size_t count = std::count(restored.begin(), restored.end(), true);
+                if (count != restoreBatch.size()) {
+                    LOG(WARNING) << "Only restored " << count << " of " << restoreBatch.size() << " logs to " << backup->getName();
+                }
             }
         }
         this->logged_putsLock.unlock();
+        doneLogTicket(backup);
     }
 
     LOG(INFO) << "Finished connecting to backups";
@@ -1154,8 +1846,6 @@ exit:
 
 int ft::Server::initialize(std::string cfg_file) {
     int status = KVCG_ESUCCESS;
-    int k = 0;
-    RequestWrapper<unsigned long long, data_t*>* pkt;
     auto start_time = std::chrono::steady_clock::now();
     bool matched = false;
     std::thread open_backup_eps_thread;
@@ -1188,13 +1878,20 @@ int ft::Server::initialize(std::string cfg_file) {
     this->provider = kvcg_config.getProvider();
     this->serverPort = kvcg_config.getServerPort();
     this->clientPort = kvcg_config.getClientPort();
+    this->parallelLogging = kvcg_config.getParallelLogging();
+    trace.resize(kvcg_config.getTraceEvents());
+    this->logSlotSize = kvcg_config.getLogSlotSize();
+    this->logSlotEntries = kvcg_config.getLogSlotEntries();
+    this->maxValueSize = kvcg_config.getMaxValueSize();
+    setAckPolicies(kvcg_config.getAckPolicies());
+    setCompressRanges(kvcg_config.getCompressRanges());
     this->cksum = kvcg_config.get_checksum();
 
     // Mark the key range of backups
     primaryKeysLock.lock();
     for (auto &backup : backupServers) {
         for (auto keyRange : primaryKeys)
-            backup->backupKeys.push_back(keyRange);
+            backup->addBackupKeyRange(keyRange);
     }
     primaryKeysLock.unlock();
 
@@ -1216,52 +1913,37 @@ int ft::Server::initialize(std::string cfg_file) {
     }
     
 
-    // Reserve memory in log history for our keys and keys of servers we are backing up
-    primaryKeysLock.lock();
-    for (auto kr : primaryKeys) {
-        for(k=kr.first; k <= kr.second; k++) {
-            pkt = new RequestWrapper<unsigned long long, data_t*>();
-            pkt->key = k;
-            pkt->value = new data_t(MAX_LOG_SIZE);
-            pkt->value->data[0] = '\0';
-            this->logged_puts->insert({k, pkt});
-            for (auto &backup : backupServers) {
-                pkt = new RequestWrapper<unsigned long long, data_t*>();
-                pkt->key = k;
-                pkt->value = new data_t(MAX_LOG_SIZE);
-                pkt->value->data[0] = '\0';
-                backup->logged_puts->insert({k, pkt});
-            }
-        }
-    }
-    primaryKeysLock.unlock();
-    for (auto &primary : primaryServers) {
-        for(auto kr : primary->getPrimaryKeys()) {
-          for (k=kr.first; k <= kr.second; k++) {
-            pkt = new RequestWrapper<unsigned long long, data_t*>();
-            pkt->key = k;
-            pkt->value = new data_t(MAX_LOG_SIZE);
-            pkt->value->data[0] = '\0';
-            this->logged_puts->insert({k, pkt});
-            pkt = new RequestWrapper<unsigned long long, data_t*>();
-            pkt->key = k;
-            pkt->value = new data_t(MAX_LOG_SIZE);
-            pkt->value->data[0] = '\0';
-            primary->logged_puts->insert({k, pkt});
-            for (auto &primBackup : primary->getBackupServers()) {
-               if (primBackup->getName() != this->getName()) {
-                   primBackup->logged_puts->insert({k, pkt});
-               }
-            }
-          }
-        }
+    // Log history is sparse, entries are only created for keys
+    // as they are logged (see setLogEntry)
+
+    // New log stream every boot. Backups only catch up incrementally
+    // within a stream, restarting numbering could skip updates.
+    {
+        std::random_device rd;
+        do {
+            this->logEpoch = ((uint64_t)rd() << 32) | rd();
+        } while (this->logEpoch == 0);
     }
 
+    this->heartbeatIntervalMs = kvcg_config.getHeartbeatIntervalMs();
+    this->heartbeatTimeoutMs = kvcg_config.getHeartbeatTimeoutMs();
+    this->phiThreshold = kvcg_config.getPhiThreshold();
+    heartbeatWheel.setTickMs(std::max(1, heartbeatIntervalMs / HB_WHEEL_RESOLUTION));
+
+    // Restore log history from disk before anything is served
+    this->snapshotDir = kvcg_config.getSnapshotDir();
+    this->snapshotIntervalMs = kvcg_config.getSnapshotIntervalMs();
+    if (status = restoreLogHistory(kvcg_config.getWalDir(), kvcg_config.getWalSegmentSize()))
+        goto exit;
+
     printServer(INFO);
 
     // Open connection for other servers to backup here
     open_backup_eps_thread = std::thread(&ft::Server::open_backup_endpoints, this, nullptr, 'b', 0, &status);
 
+    // Start writing heartbeats, backups are added as they connect
+    heartbeat_thread = new std::thread(&ft::Server::heartbeat_loop, this);
+
     // Connect to this servers backups
     if (status = connect_backups())
         goto exit;
@@ -1271,13 +1953,31 @@ int ft::Server::initialize(std::string cfg_file) {
         goto exit; 
 
     // Start listening for backup requests
+    for (int i=0; i < kvcg_config.getPollerThreads(); i++) {
+        pollers.emplace_back(new Poller());
+    }
+    for (int i=0; i < pollers.size(); i++) {
+        int cpu = kvcg_config.getPollerCpu() < 0 ? -1 : kvcg_config.getPollerCpu() + i;
+        pollers[i]->thread = new std::thread(&ft::Server::poll_primaries, this, pollers[i].get(), cpu);
+    }
     for (auto &primary : primaryServers) {
-        primary_listen_threads.push_back(new std::thread(&ft::Server::primary_listen, this, primary));
+        watchPrimary(primary);
     }
 
     // Start listening for clients
+    for (int i=0; i < DISCOVERY_THREADS; i++) {
+        discovery_threads.push_back(new std::thread(&ft::Server::discovery_handshake, this));
+    }
     client_listen_thread = new std::thread(&ft::Server::client_listen, this);
 
+    // Start sending async log requests
+    log_ship_thread = new std::thread(&ft::Server::log_ship, this);
+
+    // Start taking snapshots of log history
+    if (this->snapshotDir != "" && this->snapshotIntervalMs > 0) {
+        snapshot_thread = new std::thread(&ft::Server::snapshot_loop, this);
+    }
+
 
    // see what changed after primary/backup negotation
    printServer(DEBUG);
@@ -1298,12 +1998,18 @@ void ft::Server::shutdownServer() {
   LOG(INFO) << "Shutting down server";
   shutting_down = true;
   LOG(DEBUG3) << "Stopping heartbeat";
-  for (auto& t : heartbeat_threads) {
-    if (t->joinable()) {
-	  LOG(DEBUG4) << "Join heartbeat thread: " << t->get_id();
-      // FIXME: detach is not really correct, but they will disappear on program termination...
-      t->detach();
+  if (heartbeat_thread != nullptr && heartbeat_thread->joinable()) {
+    heartbeat_thread->join();
+  }
+  LOG(DEBUG3) << "Stopping backup reconnects";
+  {
+    // Nothing starts more once the heartbeat has stopped, and they give
+    // up waiting for the backup once shutting_down is set
+    std::unique_lock<std::mutex> lock(recoverLock);
+    for (auto& t : recoverThreads) {
+      t.join();
     }
+    recoverThreads.clear();
   }
 
   if (client_listen_thread != nullptr && client_listen_thread->joinable()) {
@@ -1311,22 +2017,78 @@ void ft::Server::shutdownServer() {
     // FIXME: detach is not really correct, but they will disappear on program termination...
     client_listen_thread->detach();
   }
-  LOG(DEBUG3) << "Closing primary listening threads";
-  for (auto& t : primary_listen_threads) {
+  if (log_ship_thread != nullptr && log_ship_thread->joinable()) {
+    LOG(DEBUG3) << "Closing log shipping thread";
+    {
+      std::unique_lock<std::mutex> lock(logGroupLock);
+      logShipStop = true;
+      logGroupCv.notify_all();
+    }
+    // Sends whatever is still queued before it returns
+    log_ship_thread->join();
+  }
+  LOG(DEBUG3) << "Waiting for log senders";
+  {
+    std::unique_lock<std::mutex> lock(shipLock);
+    shipCv.wait(lock, [this]() { return shipsInFlight == 0; });
+  }
+  if (snapshot_thread != nullptr && snapshot_thread->joinable()) {
+    LOG(DEBUG3) << "Closing snapshot thread";
+    snapshot_thread->join();
+  }
+  LOG(DEBUG3) << "Closing discovery threads";
+  discoveryQueueCv.notify_all();
+  for (auto& t : discovery_threads) {
     if (t->joinable()) {
-      // FIXME: detach is not really correct, but will disappear on program termination...
+      // FIXME: detach is not really correct, but they will disappear on program termination...
       t->detach();
     }
   }
+  LOG(DEBUG3) << "Closing primary pollers";
+  for (auto& p : pollers) {
+    if (p->thread != nullptr && p->thread->joinable()) {
+      p->thread->join();
+    }
+  }
+  LOG(DEBUG3) << "Stopping failovers";
+  {
+    // Only pollers start them, and their connect and accept waits give
+    // up once shutting_down is set
+    std::unique_lock<std::mutex> lock(failoverLock);
+    for (auto& t : failoverThreads) {
+      t.join();
+    }
+    failoverThreads.clear();
+  }
 }
 
 bool ft::Server::addKeyRange(std::pair<unsigned long long, unsigned long long> keyRange) {
   primaryKeysLock.lock();
   primaryKeys.push_back(keyRange);
+  publishPrimaryKeys();
   primaryKeysLock.unlock();
   return true;
 }
 
+void ft::Server::setKeyRanges(std::vector<std::pair<unsigned long long, unsigned long long>> keyRanges) {
+  primaryKeysLock.lock();
+  primaryKeys = keyRanges;
+  publishPrimaryKeys();
+  primaryKeysLock.unlock();
+}
+
+void ft::Server::addBackupKeyRange(std::pair<unsigned long long, unsigned long long> keyRange) {
+  std::unique_lock<std::mutex> lock(backupKeysLock);
+  backupKeys.push_back(keyRange);
+  backupKeyIndex.publish(backupKeys);
+}
+
+void ft::Server::removeBackupKeyRange(std::pair<unsigned long long, unsigned long long> keyRange) {
+  std::unique_lock<std::mutex> lock(backupKeysLock);
+  backupKeys.erase(std::remove(backupKeys.begin(), backupKeys.end(), keyRange), backupKeys.end());
+  backupKeyIndex.publish(backupKeys);
+}
+
 bool ft::Server::addPrimaryServer(ft::Server* s) {
   // TODO: Validate input
   primaryServers.push_back(s);
@@ -1342,22 +2104,13 @@ bool ft::Server::addBackupServer(ft::Server* s) {
 
 
 bool ft::Server::isPrimary(unsigned long long key) {
-    std::unique_lock<std::mutex> lock(primaryKeysLock);
-    for (auto el : primaryKeys) {
-        if (key >= el.first && key <= el.second) {
-            return true;
-        }
-    }
-    return false;
+    // Lock free, searches the last published snapshot of primaryKeys
+    return primaryKeyIndex.contains(key);
 }
 
 bool ft::Server::isBackup(unsigned long long key) {
-    for (auto el : backupKeys) {
-        if (key >= el.first && key <= el.second) {
-            return true;
-        }
-    }
-    return false;
+    // Lock free, searches the last published snapshot of backupKeys
+    return backupKeyIndex.contains(key);
 }
 
 std::size_t ft::Server::getHash() {
@@ -1432,25 +2185,213 @@ void ft::Server::printServer(const LogLevel lvl) {
       LOG(DEBUG) << msg.str();
 }
 
+void ft::Server::setLogEntry(unsigned long long key, unsigned requestInteger, data_t* value, uint64_t seq /* DEFAULT 0 */) {
+    // Caller must hold logged_putsLock. Entries are created on first
+    // write and sized to the value being logged. A numbered update older
+    // than the entry, e.g. a restore overtaken by a live update, is ignored.
+    size_t size = (value == nullptr) ? 0 : value->size;
+    RequestWrapper<unsigned long long, data_t*>* entry;
+    auto elem = logged_puts->find(key);
+    if (elem == logged_puts->end()) {
+        entry = logArena.allocEntry(key, size);
+        logged_puts->insert({key, entry});
+    } else {
+        entry = elem->second;
+        if (seq != 0 && ft::LogArena::seq(entry) > seq) {
+            return;
+        }
+        logArena.resizeEntry(entry, size);
+    }
+    entry->requestInteger = requestInteger;
+    ft::LogArena::seq(entry) = seq;
+    if (size > 0) {
+        memcpy(entry->value->data, value->data, size);
+    }
+}
+
+std::string ft::Server::snapshotPath(ft::Server* owner) {
+    // Our own history, or our backup copy of a primary's history
+    if (owner == this) {
+        return snapshotDir + "/" + this->getName() + ".snap";
+    }
+    return snapshotDir + "/" + this->getName() + "." + owner->getName() + ".snap";
+}
+
+int ft::Server::loadSnapshot(ft::Server* owner, uint64_t* walSegment) {
+    ft::LogSnapshot snap;
+    int status = snap.open(snapshotPath(owner));
+    if (status == KVCG_EUNAVAILABLE) {
+        // nothing saved yet
+        return KVCG_ESUCCESS;
+    } else if (status) {
+        return status;
+    }
+
+    // Entries are in key order and used straight from the mapping
+    owner->logged_putsLock.lock();
+    for (auto e = snap.begin(); e != snap.end(); e++) {
+        data_t value;
+        value.size = e->size;
+        value.data = (char*)snap.value(e);
+        owner->setLogEntry(e->key, e->requestInteger, &value);
+    }
+    if (owner != this) {
+        // where to pick up that primary's stream
+        owner->logEpoch = snap.getEpoch();
+        owner->logSeq = snap.getSeq();
+    }
+    owner->logged_putsLock.unlock();
+    LOG(INFO) << "Restored " << snap.size() << " log entries of " << owner->getName() << " from snapshot";
+
+    if (walSegment != nullptr) {
+        *walSegment = snap.getWalSegment();
+    }
+    return KVCG_ESUCCESS;
+}
+
+int ft::Server::restoreLogHistory(std::string walDir, size_t walSegmentSize) {
+    int status = KVCG_ESUCCESS;
+    uint64_t walSegment = 0;
+    std::vector<RequestWrapper<unsigned long long, data_t *>> commitBatch;
+
+    if (snapshotDir != "") {
+        if (mkdir(snapshotDir.c_str(), 0755) && errno != EEXIST) {
+            LOG(ERROR) << "Failed to create " << snapshotDir << ": " << strerror(errno);
+            return KVCG_EUNKNOWN;
+        }
+        if (status = loadSnapshot(this, &walSegment))
+            return status;
+        // Backup copies are only a head start, primaries restore the rest
+        for (auto &primary : primaryServers) {
+            if (primary != this && loadSnapshot(primary, nullptr)) {
+                LOG(WARNING) << "Ignoring snapshot of " << primary->getName();
+            }
+        }
+    }
+
+    this->logged_putsLock.lock();
+    if (walDir != "") {
+        if (status = wal.open(walDir, this->getName(), walSegmentSize)) {
+            this->logged_putsLock.unlock();
+            return status;
+        }
+
+        // Later records for a key replace earlier ones, same as logging them
+        status = wal.replay([this](RequestWrapper<unsigned long long, data_t *>& req) {
+            setLogEntry(req.key, req.requestInteger, req.value);
+        }, walSegment);
+        if (status) {
+            this->logged_putsLock.unlock();
+            return status;
+        }
+    }
+
+    // Hand the caller the recovered state to rebuild its table. Recovered
+    // entries start this boot's log stream.
+    for (auto it = logged_puts->begin(); it != logged_puts->end(); ++it) {
+        ft::LogArena::seq(it->second) = ++logSeq;
+        commitBatch.push_back(*it->second);
+    }
+    if (this->commitFn && !commitBatch.empty()) {
+        LOG(DEBUG) << "Committing " << commitBatch.size() << " recovered log entries";
+        this->commitFn(commitBatch);
+    }
+    this->logged_putsLock.unlock();
+    return status;
+}
+
+int ft::Server::takeSnapshot() {
+    int status = KVCG_ESUCCESS;
+    uint64_t walSegment = 0;
+    std::string path;
+    std::vector<char> image;
+
+    if (snapshotDir == "") {
+        LOG(ERROR) << "No snapshotDir configured";
+        return KVCG_EINVALID;
+    }
+    path = snapshotPath(this);
+
+    // Become the log group leader so no group is between its write-ahead
+    // log append and its log history update. Everything appended so far
+    // is then in the snapshot, and later groups go to a new segment.
+    // Only copy the history in memory while logging is held up.
+    pauseLogGroups();
+    this->logged_putsLock.lock();
+    if (wal.isOpen() && (status = wal.rollover(&walSegment))) {
+        LOG(ERROR) << "Failed to start new write-ahead log segment for snapshot";
+    }
+    if (!status) {
+        ft::LogSnapshot::capture(*logged_puts, walSegment, logEpoch, logSeq, &image);
+    }
+    this->logged_putsLock.unlock();
+    resumeLogGroups();
+
+    // Write and sync outside the locks, the old snapshot and segments stay valid until done
+    if (!status && !(status = ft::LogSnapshot::writeImage(path, image)) &&
+        !(status = ft::LogSnapshot::commit(path)) && wal.isOpen()) {
+        wal.removeSegmentsBefore(walSegment);
+    }
+
+    // Backup copies of our primaries' history
+    std::vector<ft::Server*> primaries = primaryServers;
+    for (auto &primary : primaries) {
+        if (primary == this) continue;
+        path = snapshotPath(primary);
+        primary->logged_putsLock.lock();
+        ft::LogSnapshot::capture(*primary->logged_puts, 0, primary->logEpoch, primary->logSeq, &image);
+        primary->logged_putsLock.unlock();
+        int pstatus = ft::LogSnapshot::writeImage(path, image);
+        if (pstatus || (pstatus = ft::LogSnapshot::commit(path))) {
+            LOG(ERROR) << "Failed to snapshot log history of " << primary->getName();
+            status = pstatus;
+        }
+    }
+
+    return status;
+}
+
+void ft::Server::snapshot_loop() {
+    auto next = std::chrono::steady_clock::now() + std::chrono::milliseconds(snapshotIntervalMs);
+    while (!shutting_down) {
+        if (std::chrono::steady_clock::now() < next) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+        auto start_time = std::chrono::steady_clock::now();
+        int status = takeSnapshot();
+        int runtime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time).count();
+        LOG(DEBUG2) << "Snapshot took " << runtime << "us (" << status << ")";
+        next = std::chrono::steady_clock::now() + std::chrono::milliseconds(snapshotIntervalMs);
+    }
+}
+
+void ft::Server::clearLogEntries() {
+    // Caller must hold logged_putsLock
+    for (auto it = logged_puts->begin(); it != logged_puts->end(); ++it) {
+        logArena.releaseEntry(it->second);
+    }
+    logged_puts->clear();
+}
+
 void ft::Server::traceLogRecord() {
-    if (LOG_LEVEL < TRACE) return;
+    // walks every entry, called per batch
+    if (!FT_LOG_ENABLED(TRACE)) return;
 
     // keep thread safe
     std::stringstream msg;
     msg << this->getName() << " Log History\n";
     //this->logged_putsLock.lock();
     for (auto it = logged_puts->begin(); it != logged_puts->end(); ++it) {
-        if(it->second->value->data[0] != '\0') {
-            msg << "  Key[" << it->second->key << "]: ";
-            if (it->second->requestInteger == REQUEST_INSERT) {
-              msg << "INSERT ";
-            } else if (it->second->requestInteger == REQUEST_REMOVE) {
-              msg << "REMOVE ";
-            } else {
-              msg << "UNKNOWNOP(" << it->second->requestInteger << ") ";
-            }
-            msg << it->second->value->data << "\n";
+        msg << "  Key[" << it->second->key << "]: ";
+        if (it->second->requestInteger == REQUEST_INSERT) {
+          msg << "INSERT ";
+        } else if (it->second->requestInteger == REQUEST_REMOVE) {
+          msg << "REMOVE ";
+        } else {
+          msg << "UNKNOWNOP(" << it->second->requestInteger << ") ";
         }
+        msg << std::string(it->second->value->data, it->second->value->size) << "\n";
     }
     //this->logged_putsLock.unlock();
 
@@ -2,52 +2,73 @@
 #include <faulttolerance/shard.h>
 #include <networklayer/connection.hh>
 
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+ft::Shard::~Shard() {
+    joinProbes();
+}
+
+void ft::Shard::joinProbes() {
+    for (auto &t : probes) {
+        t.join();
+    }
+    probes.clear();
+}
+
 int ft::Shard::discoverPrimary() {
     int status = KVCG_ESUCCESS;
-    bool found = false;
-    int offset;
-    size_t numRanges;
-    unsigned long long minKey, maxKey;
-    uint64_t mrkey = 0;
+    std::pair<unsigned long long, unsigned long long> range = keyRange;
     LOG(INFO) << "Discovering primary for shard [" << this->getLowerBound() << ", " << this->getUpperBound() << "]";
 
-    // Try to establish connection to each server in shard (non-blocking, assume down if unable)
+    // Probe every server at once and take the first one claiming our range.
+    // Probes to dead servers may outlive this call, so they only share
+    // state through the shared_ptr. They are joined before the next
+    // discovery or when the Shard goes away, connecting is non-blocking
+    // so that does not wait long, and the servers outlive their Shards.
+    joinProbes();
+    struct Discovery {
+        std::mutex lock;
+        std::condition_variable cv;
+        ft::Server* primary = nullptr;
+        size_t pending;
+    };
+    auto discovery = std::make_shared<Discovery>();
+    discovery->pending = this->getServers().size();
+
     for (auto server : this->getServers()) {
-        server->primary_conn = new cse498::Connection(server->getAddr().c_str(), false, server->getClientPort(), server->getProvider());
-        if(!server->primary_conn->connect()) {
-            // TBD: is connect() blocking? is there an alternative?
-            delete server->primary_conn;
-            continue;
-        }
-        cse498::unique_buf resp(4096);
-        server->primary_conn->register_mr(resp, FI_SEND | FI_RECV, mrkey);
-        server->primary_conn->recv(resp, 4096);
-        memcpy(&numRanges, resp.get(), sizeof(size_t)); 
-
-        // TODO: Calculate if number of ranges creates buffer that is >4096 and handle
-        offset = sizeof(size_t);
-        for (int i=0; i < numRanges; i++) {
-            memcpy(&minKey, resp.get()+offset, sizeof(unsigned long long));
-            offset += sizeof(unsigned long long);
-            memcpy(&maxKey, resp.get()+offset, sizeof(unsigned long long));
-            offset += sizeof(unsigned long long);
-            if (minKey == this->getLowerBound() && maxKey == this->getUpperBound()) {
-                LOG(INFO) << "Found primary " << server->getName();
-                this->setPrimary(server);
-                found = true;
-                break;
+        probes.emplace_back([discovery, server, range]() {
+            std::vector<std::pair<unsigned long long, unsigned long long>> ranges;
+            bool found = false;
+            if (server->queryPrimaryRanges(&ranges) == KVCG_ESUCCESS) {
+                for (auto kr : ranges) {
+                    if (kr == range) {
+                        found = true;
+                        break;
+                    }
+                }
             }
-        }
-
-        delete server->primary_conn;
-
-        if (found) break;
+            std::unique_lock<std::mutex> lock(discovery->lock);
+            if (found && discovery->primary == nullptr) {
+                discovery->primary = server;
+            }
+            discovery->pending--;
+            discovery->cv.notify_all();
+        });
     }
 
-    if (!found) {
+    std::unique_lock<std::mutex> lock(discovery->lock);
+    discovery->cv.wait(lock, [&discovery]() { return discovery->primary != nullptr || discovery->pending == 0; });
+
+    if (discovery->primary == nullptr) {
         LOG(ERROR) << "Could not find primary server for shard";
         status = KVCG_EUNKNOWN;
+    } else {
+        LOG(INFO) << "Found primary " << discovery->primary->getName();
+        this->setPrimary(discovery->primary);
     }
 
     return status;
-}
\ No newline at end of file
+}
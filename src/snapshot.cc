@@ -0,0 +1,183 @@
+/****************************************************
+ *
+ * Log History Snapshot Implementation
+ *
+ ****************************************************/
+#include <faulttolerance/snapshot.h>
+
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <libgen.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <kvcg_logging.h>
+#include <kvcg_errors.h>
+
+namespace ft = cse498::faulttolerance;
+
+void ft::LogSnapshot::capture(const std::map<unsigned long long, RequestWrapper<unsigned long long, data_t*>*>& entries, uint64_t walSegment, uint64_t epoch, uint64_t seq, std::vector<char>* image) {
+    Header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic));
+    hdr.version = SNAPSHOT_VERSION;
+    hdr.count = entries.size();
+    hdr.walSegment = walSegment;
+    hdr.epoch = epoch;
+    hdr.seq = seq;
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+        // keep values 8 byte aligned
+        hdr.heapSize += (it->second->value->size + 7) & ~(size_t)7;
+    }
+    image->assign(sizeof(Header) + hdr.count*sizeof(Entry) + hdr.heapSize, 0);
+
+    // std::map is already in key order
+    char* out = image->data();
+    memcpy(out, &hdr, sizeof(Header));
+    Entry* table = (Entry*)(out + sizeof(Header));
+    char* heap = out + sizeof(Header) + hdr.count*sizeof(Entry);
+    uint64_t offset = 0;
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+        table->key = it->first;
+        table->requestInteger = it->second->requestInteger;
+        table->size = it->second->value->size;
+        table->offset = offset;
+        if (table->size > 0) {
+            memcpy(heap + offset, it->second->value->data, table->size);
+        }
+        offset += (table->size + 7) & ~(size_t)7;
+        table++;
+    }
+}
+
+int ft::LogSnapshot::writeImage(std::string path, const std::vector<char>& image) {
+    std::string tmpPath = path + ".tmp";
+    int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        LOG(ERROR) << "Failed to open " << tmpPath << ": " << strerror(errno);
+        return KVCG_EUNKNOWN;
+    }
+    size_t done = 0;
+    while (done < image.size()) {
+        ssize_t n = ::write(fd, image.data() + done, image.size() - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            LOG(ERROR) << "Failed to write " << tmpPath << ": " << strerror(errno);
+            ::close(fd);
+            return KVCG_EUNKNOWN;
+        }
+        done += n;
+    }
+    ::close(fd);
+
+    LOG(DEBUG2) << "Wrote snapshot of " << ((const Header*)image.data())->count << " entries (" << image.size() << " bytes) to " << tmpPath;
+    return KVCG_ESUCCESS;
+}
+
+int ft::LogSnapshot::write(std::string path, const std::map<unsigned long long, RequestWrapper<unsigned long long, data_t*>*>& entries, uint64_t walSegment, uint64_t epoch /* DEFAULT 0 */, uint64_t seq /* DEFAULT 0 */) {
+    std::vector<char> image;
+    capture(entries, walSegment, epoch, seq, &image);
+    return writeImage(path, image);
+}
+
+int ft::LogSnapshot::commit(std::string path) {
+    std::string tmpPath = path + ".tmp";
+    int fd = ::open(tmpPath.c_str(), O_RDWR);
+    if (fd < 0) {
+        LOG(ERROR) << "Failed to open " << tmpPath << ": " << strerror(errno);
+        return KVCG_EUNKNOWN;
+    }
+    if (fsync(fd)) {
+        LOG(ERROR) << "Failed syncing " << tmpPath << ": " << strerror(errno);
+        ::close(fd);
+        return KVCG_EUNKNOWN;
+    }
+    ::close(fd);
+
+    if (rename(tmpPath.c_str(), path.c_str())) {
+        LOG(ERROR) << "Failed to replace " << path << ": " << strerror(errno);
+        return KVCG_EUNKNOWN;
+    }
+
+    // Make the rename itself durable
+    std::string dir = path;
+    int dirfd = ::open(dirname(&dir[0]), O_RDONLY);
+    if (dirfd >= 0) {
+        fsync(dirfd);
+        ::close(dirfd);
+    }
+    return KVCG_ESUCCESS;
+}
+
+int ft::LogSnapshot::open(std::string path) {
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return KVCG_EUNAVAILABLE;
+        }
+        LOG(ERROR) << "Failed to open " << path << ": " << strerror(errno);
+        return KVCG_EUNKNOWN;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || (size_t)st.st_size < sizeof(Header)) {
+        LOG(ERROR) << "Snapshot " << path << " is truncated";
+        ::close(fd);
+        return KVCG_EINVALID;
+    }
+    mapSize = st.st_size;
+    map = (char*)mmap(nullptr, mapSize, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        LOG(ERROR) << "Failed to map " << path << ": " << strerror(errno);
+        map = nullptr;
+        return KVCG_EUNKNOWN;
+    }
+
+    header = (const Header*)map;
+    // Bound count before multiplying so a corrupt header cannot wrap the size check
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) || header->version != SNAPSHOT_VERSION ||
+        header->count > (mapSize - sizeof(Header))/sizeof(Entry) ||
+        header->heapSize != mapSize - sizeof(Header) - header->count*sizeof(Entry)) {
+        LOG(ERROR) << "Snapshot " << path << " is not valid";
+        close();
+        return KVCG_EINVALID;
+    }
+    table = (const Entry*)(map + sizeof(Header));
+    heap = map + sizeof(Header) + header->count*sizeof(Entry);
+    for (const Entry* e = begin(); e != end(); e++) {
+        if (e->offset > header->heapSize || e->size > header->heapSize - e->offset) {
+            LOG(ERROR) << "Snapshot " << path << " entry for key " << e->key << " is outside the heap";
+            close();
+            return KVCG_EINVALID;
+        }
+    }
+    LOG(DEBUG2) << "Opened snapshot " << path << " of " << header->count << " entries";
+    return KVCG_ESUCCESS;
+}
+
+void ft::LogSnapshot::close() {
+    if (map != nullptr) {
+        munmap(map, mapSize);
+    }
+    map = nullptr;
+    mapSize = 0;
+    header = nullptr;
+    table = nullptr;
+    heap = nullptr;
+}
+
+const ft::LogSnapshot::Entry* ft::LogSnapshot::find(unsigned long long key) {
+    const Entry* it = std::lower_bound(begin(), end(), key,
+        [](const Entry& e, unsigned long long k) { return e.key < k; });
+    if (it == end() || it->key != key) {
+        return nullptr;
+    }
+    return it;
+}
@@ -0,0 +1,54 @@
+/****************************************************
+ *
+ * Timer Wheel Implementation
+ *
+ ****************************************************/
+#include <faulttolerance/timer_wheel.h>
+
+namespace ft = cse498::faulttolerance;
+
+ft::TimerWheel::TimerWheel(unsigned int tickMs /* DEFAULT 1 */, size_t numSlots /* DEFAULT TIMER_WHEEL_SLOTS */) :
+    slots(numSlots == 0 ? 1 : numSlots) {
+    setTickMs(tickMs);
+}
+
+void ft::TimerWheel::schedule(uint64_t id, unsigned int delayMs) {
+    uint64_t ticks = (delayMs + tickMs - 1) / tickMs;
+    if (ticks == 0) ticks = 1;
+    // tick visits the target slot after ticks, ticks+n, ticks+2n, ... calls
+    slots[(current + ticks) % slots.size()].push_back({id, (ticks - 1) / slots.size()});
+    count++;
+}
+
+bool ft::TimerWheel::cancel(uint64_t id) {
+    bool found = false;
+    for (auto &slot : slots) {
+        for (size_t i = 0; i < slot.size(); ) {
+            if (slot[i].id == id) {
+                slot[i] = slot.back();
+                slot.pop_back();
+                count--;
+                found = true;
+            } else {
+                i++;
+            }
+        }
+    }
+    return found;
+}
+
+void ft::TimerWheel::tick(std::vector<uint64_t>& expired) {
+    current = (current + 1) % slots.size();
+    auto &slot = slots[current];
+    for (size_t i = 0; i < slot.size(); ) {
+        if (slot[i].rounds == 0) {
+            expired.push_back(slot[i].id);
+            slot[i] = slot.back();
+            slot.pop_back();
+            count--;
+        } else {
+            slot[i].rounds--;
+            i++;
+        }
+    }
+}
@@ -0,0 +1,93 @@
+/****************************************************
+ *
+ * Binary Trace Ring Implementation
+ *
+ ****************************************************/
+#include <faulttolerance/trace_ring.h>
+
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <kvcg_logging.h>
+#include <kvcg_errors.h>
+
+namespace ft = cse498::faulttolerance;
+
+void ft::TraceRing::resize(size_t events) {
+    size_t size = 1;
+    while (size < events) {
+        size <<= 1;
+    }
+    if (events == 0) {
+        slots.reset();
+        mask = 0;
+    } else {
+        slots.reset(new Slot[size]);
+        mask = size - 1;
+    }
+    head = 0;
+}
+
+void ft::TraceRing::snapshot(std::vector<ft::TraceEvent>* events) {
+    std::vector<std::pair<uint64_t, ft::TraceEvent>> numbered;
+    events->clear();
+    if (mask == 0) return;
+
+    for (size_t i = 0; i <= mask; i++) {
+        Slot& slot = slots[i];
+        ft::TraceEvent ev;
+        uint64_t before = slot.seq.load(std::memory_order_acquire);
+        if (before == 0) {
+            continue;
+        }
+        ev.timeNs = slot.words[0].load(std::memory_order_relaxed);
+        ev.type = slot.words[1].load(std::memory_order_relaxed);
+        ev.key = slot.words[2].load(std::memory_order_relaxed);
+        ev.arg = slot.words[3].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) != before) {
+            // rewritten while we read it
+            continue;
+        }
+        numbered.push_back({before, ev});
+    }
+
+    std::sort(numbered.begin(), numbered.end(),
+        [](const std::pair<uint64_t, ft::TraceEvent>& a, const std::pair<uint64_t, ft::TraceEvent>& b) {
+            return a.first < b.first;
+        });
+    for (auto &n : numbered) {
+        events->push_back(n.second);
+    }
+}
+
+int ft::TraceRing::dump(std::string filename) {
+    std::vector<ft::TraceEvent> events;
+    snapshot(&events);
+
+    char hdr[8 + 2*sizeof(uint64_t)];
+    uint64_t version = TRACE_VERSION;
+    uint64_t count = events.size();
+    memcpy(hdr, TRACE_MAGIC, 8);
+    memcpy(hdr + 8, &version, sizeof(uint64_t));
+    memcpy(hdr + 8 + sizeof(uint64_t), &count, sizeof(uint64_t));
+
+    int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        LOG(ERROR) << "Failed to open " << filename << ": " << strerror(errno);
+        return KVCG_EUNKNOWN;
+    }
+    bool ok = ::write(fd, hdr, sizeof(hdr)) == (ssize_t)sizeof(hdr) &&
+              (count == 0 || ::write(fd, events.data(), count*sizeof(ft::TraceEvent)) == (ssize_t)(count*sizeof(ft::TraceEvent)));
+    ::close(fd);
+    if (!ok) {
+        LOG(ERROR) << "Failed to write trace to " << filename << ": " << strerror(errno);
+        return KVCG_EUNKNOWN;
+    }
+
+    LOG(DEBUG2) << "Wrote " << count << " trace events to " << filename;
+    return KVCG_ESUCCESS;
+}
@@ -0,0 +1,296 @@
+/****************************************************
+ *
+ * Write-Ahead Log Implementation
+ *
+ ****************************************************/
+#include <faulttolerance/wal.h>
+
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <kvcg_logging.h>
+#include <kvcg_errors.h>
+#include <RequestTypes.hh>
+
+namespace ft = cse498::faulttolerance;
+
+uint32_t ft::WriteAheadLog::crc32(const char* data, size_t len) {
+    static uint32_t table[256];
+    static bool tableReady = [] {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : (c >> 1);
+            }
+            table[i] = c;
+        }
+        return true;
+    }();
+    (void)tableReady;
+
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < len; i++) {
+        crc = table[(crc ^ (uint8_t)data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFF;
+}
+
+std::string ft::WriteAheadLog::segmentPath(uint64_t index) {
+    char file[32];
+    snprintf(file, sizeof(file), "-%08llu.wal", (unsigned long long)index);
+    return dir + "/" + name + file;
+}
+
+std::vector<uint64_t> ft::WriteAheadLog::listSegments() {
+    std::vector<uint64_t> segments;
+    DIR* d = opendir(dir.c_str());
+    if (d == nullptr) {
+        return segments;
+    }
+    std::string prefix = name + "-";
+    struct dirent* ent;
+    while ((ent = readdir(d)) != nullptr) {
+        std::string file = ent->d_name;
+        if (file.size() <= prefix.size() + 4 || file.compare(0, prefix.size(), prefix) != 0 ||
+            file.compare(file.size() - 4, 4, ".wal") != 0) {
+            continue;
+        }
+        std::string index = file.substr(prefix.size(), file.size() - prefix.size() - 4);
+        if (index.find_first_not_of("0123456789") != std::string::npos) {
+            continue;
+        }
+        segments.push_back(std::stoull(index));
+    }
+    closedir(d);
+    std::sort(segments.begin(), segments.end());
+    return segments;
+}
+
+int ft::WriteAheadLog::openSegment(uint64_t index) {
+    std::string path = segmentPath(index);
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        LOG(ERROR) << "Failed to open " << path << ": " << strerror(errno);
+        return KVCG_EUNKNOWN;
+    }
+    // Reserve the whole segment now so appends only write data
+    int err = posix_fallocate(fd, 0, segmentSize);
+    if (err) {
+        LOG(ERROR) << "Failed to preallocate " << path << ": " << strerror(err);
+        ::close(fd);
+        fd = -1;
+        return KVCG_EUNKNOWN;
+    }
+    fsync(fd);
+
+    // Make sure the new file itself survives a crash
+    int dirfd = ::open(dir.c_str(), O_RDONLY);
+    if (dirfd >= 0) {
+        fsync(dirfd);
+        ::close(dirfd);
+    }
+
+    LOG(DEBUG2) << "Opened write-ahead log segment " << path;
+    segment = index;
+    offset = 0;
+    return KVCG_ESUCCESS;
+}
+
+int ft::WriteAheadLog::open(std::string dir, std::string name, size_t segmentSize /* DEFAULT WAL_SEGMENT_SIZE */) {
+    std::unique_lock<std::mutex> l(lock);
+    this->dir = dir;
+    this->name = name;
+    this->segmentSize = segmentSize;
+
+    if (mkdir(dir.c_str(), 0755) && errno != EEXIST) {
+        LOG(ERROR) << "Failed to create " << dir << ": " << strerror(errno);
+        return KVCG_EUNKNOWN;
+    }
+
+    // Never append after what is already on disk, its tail may be torn
+    std::vector<uint64_t> segments = listSegments();
+    return openSegment(segments.empty() ? 0 : segments.back() + 1);
+}
+
+void ft::WriteAheadLog::close() {
+    std::unique_lock<std::mutex> l(lock);
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+int ft::WriteAheadLog::append(const std::vector<RequestWrapper<unsigned long long, data_t *>>& batch) {
+    std::unique_lock<std::mutex> l(lock);
+    if (fd < 0) {
+        return KVCG_EUNAVAILABLE;
+    }
+
+    // Layout: [len][crc][key][requestInteger][valueSize][value]
+    buf.clear();
+    for (auto &req : batch) {
+        if (req.requestInteger != REQUEST_INSERT && req.requestInteger != REQUEST_REMOVE) {
+            continue;
+        }
+        uint32_t valueSize = (req.value == nullptr) ? 0 : req.value->size;
+        uint32_t len = WAL_RECORD_FIXED_SIZE + valueSize;
+        uint32_t requestInteger = req.requestInteger;
+        size_t start = buf.size();
+        buf.resize(start + WAL_RECORD_HDR_SIZE + len);
+        char* p = buf.data() + start + WAL_RECORD_HDR_SIZE;
+        memcpy(p, &req.key, sizeof(unsigned long long));
+        p += sizeof(unsigned long long);
+        memcpy(p, &requestInteger, sizeof(uint32_t));
+        p += sizeof(uint32_t);
+        memcpy(p, &valueSize, sizeof(uint32_t));
+        p += sizeof(uint32_t);
+        if (valueSize > 0) {
+            memcpy(p, req.value->data, valueSize);
+        }
+        uint32_t crc = crc32(buf.data() + start + WAL_RECORD_HDR_SIZE, len);
+        memcpy(buf.data() + start, &len, sizeof(uint32_t));
+        memcpy(buf.data() + start + sizeof(uint32_t), &crc, sizeof(uint32_t));
+    }
+    if (buf.empty()) {
+        return KVCG_ESUCCESS;
+    }
+
+    // A group is never split across segments, leave room for the zero
+    // length that ends replay
+    if (buf.size() + WAL_RECORD_HDR_SIZE > segmentSize) {
+        LOG(ERROR) << "Log group of " << buf.size() << " bytes does not fit in a write-ahead log segment";
+        return KVCG_EINVALID;
+    }
+    if (offset + buf.size() + WAL_RECORD_HDR_SIZE > segmentSize) {
+        ::close(fd);
+        fd = -1;
+        int status = openSegment(segment + 1);
+        if (status) {
+            return status;
+        }
+    }
+
+    size_t written = 0;
+    while (written < buf.size()) {
+        ssize_t n = pwrite(fd, buf.data() + written, buf.size() - written, offset + written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            LOG(ERROR) << "Failed writing write-ahead log: " << strerror(errno);
+            return KVCG_EUNKNOWN;
+        }
+        written += n;
+    }
+    if (fdatasync(fd)) {
+        LOG(ERROR) << "Failed syncing write-ahead log: " << strerror(errno);
+        return KVCG_EUNKNOWN;
+    }
+    offset += buf.size();
+    return KVCG_ESUCCESS;
+}
+
+int ft::WriteAheadLog::rollover(uint64_t* index) {
+    std::unique_lock<std::mutex> l(lock);
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    int status = openSegment(segment + 1);
+    *index = segment;
+    return status;
+}
+
+void ft::WriteAheadLog::removeSegmentsBefore(uint64_t index) {
+    std::unique_lock<std::mutex> l(lock);
+    for (auto s : listSegments()) {
+        if (s >= index) {
+            break;
+        }
+        std::string path = segmentPath(s);
+        LOG(DEBUG2) << "Removing write-ahead log segment " << path;
+        if (unlink(path.c_str())) {
+            LOG(WARNING) << "Failed to remove " << path << ": " << strerror(errno);
+        }
+    }
+}
+
+int ft::WriteAheadLog::replay(std::function<void(RequestWrapper<unsigned long long, data_t *>&)> apply, uint64_t fromSegment /* DEFAULT 0 */) {
+    std::unique_lock<std::mutex> l(lock);
+    size_t count = 0;
+
+    for (auto index : listSegments()) {
+        if (index < fromSegment) {
+            // covered by a snapshot
+            continue;
+        }
+        if (fd >= 0 && index >= segment) {
+            // being appended to, nothing in it yet
+            break;
+        }
+        std::string path = segmentPath(index);
+        int rfd = ::open(path.c_str(), O_RDONLY);
+        if (rfd < 0) {
+            LOG(ERROR) << "Failed to open " << path << ": " << strerror(errno);
+            return KVCG_EUNKNOWN;
+        }
+        struct stat st;
+        if (fstat(rfd, &st) || st.st_size == 0) {
+            ::close(rfd);
+            continue;
+        }
+        size_t size = st.st_size;
+        char* data = (char*)mmap(nullptr, size, PROT_READ, MAP_PRIVATE, rfd, 0);
+        ::close(rfd);
+        if (data == MAP_FAILED) {
+            LOG(ERROR) << "Failed to map " << path << ": " << strerror(errno);
+            return KVCG_EUNKNOWN;
+        }
+
+        size_t pos = 0;
+        while (pos + WAL_RECORD_HDR_SIZE <= size) {
+            uint32_t len, crc;
+            memcpy(&len, data + pos, sizeof(uint32_t));
+            memcpy(&crc, data + pos + sizeof(uint32_t), sizeof(uint32_t));
+            if (len == 0) {
+                // preallocated space, end of segment
+                break;
+            }
+            if (len < WAL_RECORD_FIXED_SIZE || pos + WAL_RECORD_HDR_SIZE + len > size ||
+                crc32(data + pos + WAL_RECORD_HDR_SIZE, len) != crc) {
+                LOG(WARNING) << "Dropping torn write-ahead log record in " << path << " at offset " << pos;
+                break;
+            }
+            const char* p = data + pos + WAL_RECORD_HDR_SIZE;
+            unsigned long long key;
+            uint32_t requestInteger, valueSize;
+            memcpy(&key, p, sizeof(unsigned long long));
+            p += sizeof(unsigned long long);
+            memcpy(&requestInteger, p, sizeof(uint32_t));
+            p += sizeof(uint32_t);
+            memcpy(&valueSize, p, sizeof(uint32_t));
+            p += sizeof(uint32_t);
+            if (WAL_RECORD_FIXED_SIZE + valueSize != len) {
+                LOG(WARNING) << "Dropping malformed write-ahead log record in " << path << " at offset " << pos;
+                break;
+            }
+
+            data_t value;
+            value.size = valueSize;
+            value.data = (char*)p;
+            RequestWrapper<unsigned long long, data_t*> req{key, 0, &value, requestInteger};
+            apply(req);
+            count++;
+
+            pos += WAL_RECORD_HDR_SIZE + len;
+        }
+        munmap(data, size);
+    }
+
+    LOG(INFO) << "Replayed " << count << " write-ahead log records";
+    return KVCG_ESUCCESS;
+}
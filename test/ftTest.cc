@@ -3,13 +3,29 @@
 #include <iostream>
 #include <vector>
 #include <map>
+#include <algorithm>
+#include <fstream>
+#include <future>
 #include <faulttolerance/fault_tolerance.h>
+#include <faulttolerance/kvcg_config.h>
+#include <faulttolerance/wal.h>
+#include <faulttolerance/snapshot.h>
+#include <faulttolerance/timer_wheel.h>
+#include <faulttolerance/phi_accrual.h>
+#include <faulttolerance/log_batch.h>
+#include <faulttolerance/lz.h>
+#include <faulttolerance/trace_ring.h>
+#include <faulttolerance/ft_logging.h>
 #include <data_t.hh>
 #include <gtest/gtest.h>
+#include <boost/asio/ip/host_name.hpp>
 
 namespace ft = cse498::faulttolerance;
 
 std::string cfgFile = "gtest_kvcg.json";
+// Small log slots, snapshots and tracing, see run_gtest.sh
+std::string restoreCfgFile = "gtest_kvcg_restore.json";
+std::string restoreSnapDir = "gtest_restore_snap";
  
 TEST(ftTest, single_logRequest) {
     LOG_LEVEL = DEBUG;
@@ -154,6 +170,105 @@ TEST(ftTest, bad_batch) {
     std::this_thread::sleep_for(std::chrono::milliseconds(1000));
 }
 
+TEST(ftTest, concurrent_put) {
+    LOG_LEVEL = INFO;
+    ft::Server* server = new ft::Server();
+    EXPECT_EQ(0, server->initialize(cfgFile));
+
+    // Concurrent callers are group committed, but each must still
+    // get back its own status and failed keys
+    int numThreads = 32;
+    std::vector<std::thread> threads;
+    std::vector<int> status(numThreads);
+    std::vector<std::vector<RequestWrapper<unsigned long long, data_t *>>> failed(numThreads);
+    for (int t=0; t < numThreads; t++) {
+        threads.emplace_back([&, t]() {
+            std::vector<RequestWrapper<unsigned long long, data_t *>> batch;
+            for (unsigned long long i=0; i<16; i++) {
+                std::string valueStr = "word" + std::to_string(t) + "_" + std::to_string(i);
+                data_t* value = new data_t(valueStr.length()+1);
+                memcpy(value->data, valueStr.c_str(), valueStr.length());
+                value->data[valueStr.length()] = '\0';
+                RequestWrapper<unsigned long long, data_t*> pkt{(unsigned long long)(t*16+i), 0, value, REQUEST_INSERT};
+                batch.push_back(pkt);
+            }
+            if (t % 4 == 0) {
+                // not a key we are primary for
+                data_t* value = new data_t(5);
+                memcpy(value->data, "word", 5);
+                RequestWrapper<unsigned long long, data_t*> pkt{(unsigned long long)(2000+t), 0, value, REQUEST_INSERT};
+                batch.push_back(pkt);
+            }
+            status[t] = server->logRequest(batch, &failed[t]);
+        });
+    }
+    for (auto &th : threads) {
+        th.join();
+    }
+
+    for (int t=0; t < numThreads; t++) {
+        if (t % 4 == 0) {
+            EXPECT_NE(0, status[t]);
+            ASSERT_EQ(1, failed[t].size());
+            EXPECT_EQ(2000+t, failed[t][0].key);
+        } else {
+            EXPECT_EQ(0, status[t]);
+            EXPECT_EQ(0, failed[t].size());
+        }
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+    delete server;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+}
+
+TEST(ftTest, async_put) {
+    LOG_LEVEL = INFO;
+    ft::Server* server = new ft::Server();
+    EXPECT_EQ(0, server->initialize(cfgFile));
+
+    std::vector<RequestWrapper<unsigned long long, data_t *>> batch;
+    for (unsigned long long i=0; i<64; i++) {
+        std::string valueStr = "word" + std::to_string(i);
+        data_t* value = new data_t(valueStr.length()+1);
+        memcpy(value->data, valueStr.c_str(), valueStr.length());
+        value->data[valueStr.length()] = '\0';
+        RequestWrapper<unsigned long long, data_t*> pkt{i, 0, value, REQUEST_INSERT};
+        batch.push_back(pkt);
+    }
+    std::vector<RequestWrapper<unsigned long long, data_t *>> badBatch = batch;
+    data_t* value = new data_t(5);
+    memcpy(value->data, "word", 5);
+    RequestWrapper<unsigned long long, data_t*> pkt{2000, 0, value, REQUEST_INSERT};
+    badBatch.push_back(pkt);
+
+    // future
+    std::vector<RequestWrapper<unsigned long long, data_t *>> failedBatch;
+    std::future<int> good = server->logRequestAsync(batch);
+    std::future<int> bad = server->logRequestAsync(badBatch, &failedBatch);
+    EXPECT_EQ(0, good.get());
+    EXPECT_NE(0, bad.get());
+    ASSERT_EQ(1, failedBatch.size());
+    EXPECT_EQ(2000, failedBatch[0].key);
+
+    // callback
+    std::promise<void> called;
+    int cbStatus = -1;
+    size_t cbFailed = 0;
+    server->logRequestAsync(badBatch, [&](int status, std::vector<RequestWrapper<unsigned long long, data_t *>>& failed) {
+        cbStatus = status;
+        cbFailed = failed.size();
+        called.set_value();
+    });
+    called.get_future().wait();
+    EXPECT_NE(0, cbStatus);
+    EXPECT_EQ(1, cbFailed);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+    delete server;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+}
+
 TEST(ftTest, unfold_requests) {
     LOG_LEVEL = DEBUG2;
     std::unordered_map<unsigned long long, data_t *> store;
@@ -214,4 +329,871 @@ TEST(ftTest, unfold_requests) {
             LOG(DEBUG2) << "Unexpect key returned from unfoldRequest";
         }
     }
-}
\ No newline at end of file
+}
+TEST(ftTest, log_arena) {
+    ft::LogArena arena;
+
+    EXPECT_EQ(LOG_ARENA_MIN_CLASS, ft::LogArena::classSize(0));
+    EXPECT_EQ(LOG_ARENA_MIN_CLASS, ft::LogArena::classSize(LOG_ARENA_MIN_CLASS));
+    EXPECT_EQ(64, ft::LogArena::classSize(33));
+    EXPECT_EQ(4096, ft::LogArena::classSize(4000));
+
+    // Released blocks are reused for the same size class
+    char* a = arena.allocate(100);
+    arena.release(a, 100);
+    EXPECT_EQ(a, arena.allocate(120));
+
+    // Entries keep their buffer when resized within a class
+    auto entry = arena.allocEntry(7, 20);
+    EXPECT_EQ(7, entry->key);
+    EXPECT_EQ(20, entry->value->size);
+    char* data = entry->value->data;
+    arena.resizeEntry(entry, 30);
+    EXPECT_EQ(data, entry->value->data);
+    EXPECT_EQ(30, entry->value->size);
+    // Sequence number lives beside the entry and starts unset
+    EXPECT_EQ(0, ft::LogArena::seq(entry));
+    ft::LogArena::seq(entry) = 42;
+    arena.resizeEntry(entry, 3000);
+    EXPECT_EQ(42, ft::LogArena::seq(entry));
+    EXPECT_NE(data, entry->value->data);
+    memset(entry->value->data, 'x', 3000);
+    arena.releaseEntry(entry);
+
+    // Oversized values are served outside of the slabs
+    char* big = arena.allocate(LOG_ARENA_SLAB_SIZE*2);
+    memset(big, 'y', LOG_ARENA_SLAB_SIZE*2);
+    arena.release(big, LOG_ARENA_SLAB_SIZE*2);
+    EXPECT_EQ(big, arena.allocate(LOG_ARENA_SLAB_SIZE*2));
+}
+
+TEST(ftTest, timer_wheel) {
+    ft::TimerWheel wheel(10, 4);
+    std::vector<uint64_t> expired;
+
+    // Delays round up to whole ticks, never less than one
+    wheel.schedule(1, 0);
+    wheel.schedule(2, 15);
+    wheel.schedule(3, 20);
+    // Longer than a full turn of the wheel
+    wheel.schedule(4, 100);
+    EXPECT_EQ(4, wheel.size());
+
+    wheel.tick(expired);
+    EXPECT_EQ(std::vector<uint64_t>({1}), expired);
+    expired.clear();
+    wheel.tick(expired);
+    std::sort(expired.begin(), expired.end());
+    EXPECT_EQ(std::vector<uint64_t>({2, 3}), expired);
+    expired.clear();
+
+    for (int i = 3; i < 10; i++) {
+        wheel.tick(expired);
+        EXPECT_TRUE(expired.empty()) << "tick " << i;
+    }
+    wheel.tick(expired);
+    EXPECT_EQ(std::vector<uint64_t>({4}), expired);
+    EXPECT_EQ(0, wheel.size());
+    expired.clear();
+
+    // Cancelled timers never expire
+    wheel.schedule(5, 10);
+    EXPECT_TRUE(wheel.cancel(5));
+    EXPECT_FALSE(wheel.cancel(5));
+    wheel.tick(expired);
+    EXPECT_TRUE(expired.empty());
+}
+
+TEST(ftTest, phi_accrual) {
+    using ms = std::chrono::milliseconds;
+    ft::PhiAccrualDetector detector(50, 5);
+    auto t = std::chrono::steady_clock::now();
+    EXPECT_EQ(0, detector.phi(t));
+
+    // Steady heartbeats every 50ms
+    for (int i = 0; i < 100; i++) {
+        detector.heartbeat(t);
+        t += ms(50);
+    }
+    t -= ms(50);
+    EXPECT_NEAR(50, detector.getMeanMs(), 1);
+    EXPECT_LT(detector.phi(t + ms(50)), 1);
+    EXPECT_GT(detector.phi(t + ms(100)), PHI_THRESHOLD);
+    // Suspicion only grows while no heartbeat arrives
+    EXPECT_LT(detector.phi(t + ms(60)), detector.phi(t + ms(70)));
+
+    // Other traffic restarts the wait without skewing the intervals
+    detector.alive(t + ms(60));
+    EXPECT_LT(detector.phi(t + ms(100)), 1);
+    EXPECT_NEAR(50, detector.getMeanMs(), 1);
+
+    // Jittery heartbeats take longer to suspect
+    ft::PhiAccrualDetector jittery(50, 5);
+    auto j = std::chrono::steady_clock::now();
+    for (int i = 0; i < 100; i++) {
+        jittery.heartbeat(j);
+        j += ms(i % 2 ? 20 : 80);
+    }
+    j -= ms(20);
+    EXPECT_LT(jittery.phi(j + ms(100)), PHI_THRESHOLD);
+
+    // Reset forgets the history
+    detector.reset();
+    EXPECT_EQ(0, detector.phi(t + ms(1000)));
+}
+
+TEST(ftTest, log_batch) {
+    char buf[256];
+    char big[300];
+    data_t a, b, empty;
+    a.data = (char*)"hello"; a.size = 6;
+    b.data = (char*)"world!"; b.size = 7;
+    empty.size = 0;
+    memset(big, 'z', sizeof(big));
+    data_t large;
+    large.data = big; large.size = sizeof(big);
+
+    ft::LogBatchWriter writer(buf, sizeof(buf));
+    writer.setBaseSeq(4);
+    EXPECT_TRUE(writer.empty());
+    // Clustered keys, going down, a remove, and a non log request type
+    ASSERT_TRUE(writer.append({1000, 0, &a, REQUEST_INSERT}, 5));
+    ASSERT_TRUE(writer.append({1001, 0, &b, REQUEST_INSERT}, 6));
+    ASSERT_TRUE(writer.append({3, 0, &empty, REQUEST_REMOVE}, 7));
+    ASSERT_TRUE(writer.append({~0ULL, 0, &a, REQUEST_GET}, 8));
+    EXPECT_FALSE(writer.append({4, 0, &large, REQUEST_INSERT}, 9));
+    EXPECT_EQ(4, writer.size());
+    EXPECT_EQ(8, writer.getSeq());
+    size_t len = writer.finish();
+    // keys, sequence numbers and lengths take a byte or two each
+    EXPECT_LT(len, LOG_BATCH_HDR_SIZE + 4*5 + 2*6 + 7);
+
+    data_t value;
+    RequestWrapper<unsigned long long, data_t*> req{0, 0, &value, 0};
+    ft::LogBatchReader reader;
+    ASSERT_EQ(0, reader.open(buf, len));
+    EXPECT_EQ(4, reader.size());
+    EXPECT_EQ(8, reader.getSeq());
+    EXPECT_EQ(4, reader.getBaseSeq());
+    ASSERT_TRUE(reader.next(&req));
+    EXPECT_EQ(1000, req.key);
+    EXPECT_EQ(5, reader.getEntrySeq());
+    EXPECT_EQ(REQUEST_INSERT, req.requestInteger);
+    EXPECT_STREQ("hello", value.data);
+    ASSERT_TRUE(reader.next(&req));
+    EXPECT_EQ(1001, req.key);
+    EXPECT_STREQ("world!", value.data);
+    ASSERT_TRUE(reader.next(&req));
+    EXPECT_EQ(3, req.key);
+    EXPECT_EQ(7, reader.getEntrySeq());
+    EXPECT_EQ(REQUEST_REMOVE, req.requestInteger);
+    EXPECT_EQ(0, value.size);
+    ASSERT_TRUE(reader.next(&req));
+    EXPECT_EQ(~0ULL, req.key);
+    EXPECT_EQ(REQUEST_GET, req.requestInteger);
+    EXPECT_FALSE(reader.next(&req));
+    EXPECT_TRUE(reader.done());
+
+    // Entry limit ends a batch before it fills
+    ft::LogBatchWriter limited(buf, sizeof(buf), 2);
+    EXPECT_TRUE(limited.append({1, 0, &a, REQUEST_INSERT}, 1));
+    EXPECT_TRUE(limited.append({2, 0, &a, REQUEST_INSERT}, 2));
+    EXPECT_FALSE(limited.append({3, 0, &a, REQUEST_INSERT}, 3));
+    len = limited.finish();
+    ASSERT_EQ(0, reader.open(buf, len));
+    EXPECT_EQ(2, reader.size());
+
+    // A value too large for a batch goes in chunks over several
+    std::vector<char> whole;
+    size_t chunks = 0;
+    ft::LogBatchWriter chunked(buf, sizeof(buf));
+    for (size_t offset = 0; offset < sizeof(big); chunks++) {
+        chunked.reset();
+        size_t n = chunked.appendChunk({42, 0, &large, REQUEST_INSERT}, offset, 9);
+        ASSERT_GT(n, 0);
+        offset += n;
+        len = chunked.finish();
+        ASSERT_EQ(0, reader.open(buf, len));
+        EXPECT_EQ(offset == sizeof(big) ? 9 : 0, reader.getSeq());
+        ASSERT_TRUE(reader.next(&req));
+        EXPECT_TRUE(reader.isChunk());
+        EXPECT_EQ(9, reader.getEntrySeq());
+        EXPECT_EQ(42, req.key);
+        EXPECT_EQ(REQUEST_INSERT, req.requestInteger);
+        EXPECT_EQ(sizeof(big), reader.getChunkTotal());
+        EXPECT_EQ(whole.size(), reader.getChunkOffset());
+        whole.insert(whole.end(), value.data, value.data + value.size);
+    }
+    EXPECT_EQ(2, chunks);
+    ASSERT_EQ(sizeof(big), whole.size());
+    EXPECT_EQ(0, memcmp(big, whole.data(), sizeof(big)));
+
+    // Truncated batches and other versions are rejected
+    EXPECT_NE(0, reader.open(buf, len - 1));
+    buf[1]++;
+    EXPECT_NE(0, reader.open(buf, len));
+}
+
+TEST(ftTest, lz) {
+    char src[2048], comp[2048], out[2048];
+    size_t outLen;
+    // Repetitive text, runs longer than a length nibble, and short inputs
+    for (size_t i = 0; i < sizeof(src); i++) {
+        src[i] = (i < 1024) ? "key=value;"[i % 10] : 'x';
+    }
+    size_t clen = ft::Lz::compress(src, sizeof(src), comp, sizeof(comp));
+    ASSERT_GT(clen, 0);
+    EXPECT_LT(clen, sizeof(src) / 10);
+    ASSERT_EQ(0, ft::Lz::decompress(comp, clen, out, sizeof(out), &outLen));
+    ASSERT_EQ(sizeof(src), outLen);
+    EXPECT_EQ(0, memcmp(src, out, outLen));
+    for (size_t n : {0, 1, 12, 13, 300}) {
+        clen = ft::Lz::compress(src, n, comp, sizeof(comp));
+        ASSERT_GT(clen, 0);
+        ASSERT_EQ(0, ft::Lz::decompress(comp, clen, out, sizeof(out), &outLen));
+        ASSERT_EQ(n, outLen);
+        EXPECT_EQ(0, memcmp(src, out, n));
+    }
+
+    // Output that does not fit is reported, not overrun
+    EXPECT_EQ(0, ft::Lz::compress(src, sizeof(src), comp, 8));
+    clen = ft::Lz::compress(src, sizeof(src), comp, sizeof(comp));
+    EXPECT_NE(0, ft::Lz::decompress(comp, clen, out, sizeof(src) - 1, &outLen));
+    EXPECT_NE(0, ft::Lz::decompress(comp, clen - 1, out, sizeof(out), &outLen));
+
+    // Batches compress in place when it pays off and read back the same
+    char buf[MAX_LOG_SIZE], scratch[MAX_LOG_SIZE];
+    data_t value;
+    value.data = src; value.size = 100;
+    ft::LogBatchWriter writer(buf, sizeof(buf));
+    for (unsigned long long key = 0; key < 20; key++) {
+        ASSERT_TRUE(writer.append({key, 0, &value, REQUEST_INSERT}, key + 1));
+    }
+    size_t raw = LOG_BATCH_HDR_SIZE + 20*(3 + 100);
+    size_t len = writer.finish(scratch);
+    EXPECT_TRUE(writer.isCompressed());
+    EXPECT_LT(len, raw / 4);
+
+    data_t got;
+    RequestWrapper<unsigned long long, data_t*> req{0, 0, &got, 0};
+    ft::LogBatchReader reader;
+    EXPECT_NE(0, reader.open(buf, len)); // needs scratch
+    ASSERT_EQ(0, reader.open(buf, len, scratch, sizeof(scratch)));
+    EXPECT_EQ(LOG_BATCH_COMPRESSED, reader.getFlags());
+    EXPECT_EQ(20, reader.getSeq());
+    for (unsigned long long key = 0; key < 20; key++) {
+        ASSERT_TRUE(reader.next(&req));
+        EXPECT_EQ(key, req.key);
+        EXPECT_EQ(key + 1, reader.getEntrySeq());
+        ASSERT_EQ(100, got.size);
+        EXPECT_EQ(0, memcmp(src, got.data, 100));
+    }
+    EXPECT_FALSE(reader.next(&req));
+    EXPECT_TRUE(reader.done());
+
+    // Data that does not compress is sent as is
+    uint64_t x = 88172645463325252ULL;
+    for (size_t i = 0; i < sizeof(src); i++) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        src[i] = (char)x;
+    }
+    value.size = 1000;
+    writer.reset();
+    ASSERT_TRUE(writer.append({7, 0, &value, REQUEST_INSERT}, 1));
+    len = writer.finish(scratch);
+    EXPECT_FALSE(writer.isCompressed());
+    ASSERT_EQ(0, reader.open(buf, len, scratch, sizeof(scratch)));
+    EXPECT_EQ(0, reader.getFlags());
+    ASSERT_TRUE(reader.next(&req));
+    EXPECT_EQ(0, memcmp(src, got.data, 1000));
+}
+
+TEST(ftTest, trace_ring) {
+    ft::TraceRing ring;
+    std::vector<ft::TraceEvent> events;
+    // disabled until sized
+    ring.record(ft::TRACE_LOG_SEND, 1, 1);
+    ring.snapshot(&events);
+    EXPECT_TRUE(events.empty());
+
+    // Rounded up to 8, only the newest are kept, oldest first
+    ring.resize(5);
+    EXPECT_TRUE(ring.enabled());
+    for (uint64_t i = 0; i < 20; i++) {
+        ring.record(ft::TRACE_LOG_APPLY, i, 2*i);
+    }
+    ring.snapshot(&events);
+    ASSERT_EQ(8, events.size());
+    for (size_t i = 0; i < events.size(); i++) {
+        EXPECT_EQ(ft::TRACE_LOG_APPLY, events[i].type);
+        EXPECT_EQ(12 + i, events[i].key);
+        EXPECT_EQ(2*(12 + i), events[i].arg);
+        if (i > 0) {
+            EXPECT_LE(events[i-1].timeNs, events[i].timeNs);
+        }
+    }
+
+    // Concurrent writers never leave a mixed up event behind
+    ring.resize(1024);
+    std::vector<std::thread> writers;
+    for (uint64_t t = 0; t < 4; t++) {
+        writers.emplace_back([&ring, t]() {
+            for (uint64_t i = 0; i < 10000; i++) {
+                ring.record(ft::TRACE_SLOT_WRITE, t, t*10000 + i);
+            }
+        });
+    }
+    for (auto &w : writers) w.join();
+    ring.snapshot(&events);
+    ASSERT_EQ(1024, events.size());
+    for (auto &ev : events) {
+        EXPECT_EQ(ev.key, ev.arg / 10000);
+    }
+
+    std::string traceFile = "gtest_trace.bin";
+    ASSERT_EQ(0, ring.dump(traceFile));
+    std::ifstream in(traceFile, std::ios::binary);
+    char magic[8];
+    uint64_t version, count;
+    in.read(magic, sizeof(magic));
+    in.read((char*)&version, sizeof(version));
+    in.read((char*)&count, sizeof(count));
+    EXPECT_EQ(0, memcmp(TRACE_MAGIC, magic, sizeof(magic)));
+    EXPECT_EQ(TRACE_VERSION, version);
+    EXPECT_EQ(1024, count);
+    ft::TraceEvent first;
+    in.read((char*)&first, sizeof(first));
+    EXPECT_EQ(events[0].arg, first.arg);
+    remove(traceFile.c_str());
+}
+
+TEST(ftTest, ft_logging) {
+    int level = LOG_LEVEL;
+    int evaluated = 0;
+    auto arg = [&evaluated]() { return ++evaluated; };
+    LOG_LEVEL = WARNING;
+    EXPECT_FALSE(FT_LOG_ENABLED(DEBUG));
+    FT_LOG(DEBUG) << arg();
+    EXPECT_EQ(0, evaluated);
+    FT_LOG(ERROR) << arg();
+    EXPECT_EQ(1, evaluated);
+    LOG_LEVEL = level;
+}
+
+TEST(ftTest, key_range_index) {
+    ft::KeyRangeIndex index;
+    EXPECT_FALSE(index.contains(0));
+
+    // Unsorted, overlapping and adjacent ranges are merged
+    index.publish({{200, 300}, {0, 100}, {50, 150}, {301, 400}, {1000, 1000}});
+    auto ranges = index.getRanges();
+    ASSERT_EQ(3, ranges.size());
+    EXPECT_EQ(std::make_pair(0ULL, 150ULL), ranges[0]);
+    EXPECT_EQ(std::make_pair(200ULL, 400ULL), ranges[1]);
+    EXPECT_EQ(std::make_pair(1000ULL, 1000ULL), ranges[2]);
+
+    EXPECT_TRUE(index.contains(0));
+    EXPECT_TRUE(index.contains(150));
+    EXPECT_FALSE(index.contains(151));
+    EXPECT_FALSE(index.contains(199));
+    EXPECT_TRUE(index.contains(400));
+    EXPECT_FALSE(index.contains(999));
+    EXPECT_TRUE(index.contains(1000));
+    EXPECT_FALSE(index.contains(1001));
+
+    index.publish({{5, ~0ULL}});
+    EXPECT_FALSE(index.contains(4));
+    EXPECT_TRUE(index.contains(~0ULL));
+}
+
+TEST(ftTest, key_range_discovery) {
+    std::vector<char> buf(DISCOVERY_SIZE, 0);
+    std::vector<std::pair<unsigned long long, unsigned long long>> ranges;
+    uint64_t version = 0;
+    const size_t rangeSize = 2*sizeof(unsigned long long);
+
+    // Nothing published yet
+    EXPECT_FALSE(ft::Server::decodeKeyRanges(buf.data(), &ranges));
+
+    ft::Server::encodeKeyRanges(buf.data(), 2, {{0, 99}, {200, 299}, {500, 599}});
+    ASSERT_TRUE(ft::Server::decodeKeyRanges(buf.data(), &ranges, &version));
+    EXPECT_EQ(2, version);
+    ASSERT_EQ(3, ranges.size());
+    EXPECT_EQ(std::make_pair(200ULL, 299ULL), ranges[1]);
+
+    // A shorter list leaves the old trailer behind, only the new one counts
+    ft::Server::encodeKeyRanges(buf.data(), 4, {{1000, 1999}});
+    ASSERT_TRUE(ft::Server::decodeKeyRanges(buf.data(), &ranges, &version));
+    EXPECT_EQ(4, version);
+    ASSERT_EQ(1, ranges.size());
+    EXPECT_EQ(std::make_pair(1000ULL, 1999ULL), ranges[0]);
+
+    // Caught mid-update, the leading version is odd
+    uint64_t writing = 5;
+    memcpy(buf.data(), &writing, sizeof(uint64_t));
+    EXPECT_FALSE(ft::Server::decodeKeyRanges(buf.data(), &ranges));
+
+    // Leading version changed but the trailer was not written yet
+    uint64_t next = 6;
+    memcpy(buf.data(), &next, sizeof(uint64_t));
+    EXPECT_FALSE(ft::Server::decodeKeyRanges(buf.data(), &ranges));
+
+    // Trailer from an older list
+    ft::Server::encodeKeyRanges(buf.data(), 8, {{1000, 1999}});
+    uint64_t stale = 4;
+    memcpy(buf.data() + 2*sizeof(uint64_t) + rangeSize, &stale, sizeof(uint64_t));
+    EXPECT_FALSE(ft::Server::decodeKeyRanges(buf.data(), &ranges));
+
+    // No key ranges is still a valid list
+    ft::Server::encodeKeyRanges(buf.data(), 10, {});
+    ranges = {{1, 2}};
+    ASSERT_TRUE(ft::Server::decodeKeyRanges(buf.data(), &ranges, &version));
+    EXPECT_EQ(10, version);
+    EXPECT_TRUE(ranges.empty());
+
+    // Too many ranges to fit are truncated
+    size_t maxRanges = (DISCOVERY_SIZE - 3*sizeof(uint64_t)) / rangeSize;
+    std::vector<std::pair<unsigned long long, unsigned long long>> many;
+    for (unsigned long long i=0; i < maxRanges + 10; i++) {
+        many.push_back({i*10, i*10+9});
+    }
+    ft::Server::encodeKeyRanges(buf.data(), 12, many);
+    ASSERT_TRUE(ft::Server::decodeKeyRanges(buf.data(), &ranges));
+    ASSERT_EQ(maxRanges, ranges.size());
+    EXPECT_EQ(many[maxRanges-1], ranges.back());
+
+    // A corrupt count past the buffer is rejected before the trailer is read
+    uint64_t count = maxRanges + 1;
+    memcpy(buf.data() + sizeof(uint64_t), &count, sizeof(uint64_t));
+    EXPECT_FALSE(ft::Server::decodeKeyRanges(buf.data(), &ranges));
+}
+
+TEST(ftTest, client_getShard) {
+    LOG_LEVEL = DEBUG;
+    std::string clientCfg = "gtest_client_kvcg.json";
+    std::ofstream cfg(clientCfg);
+    cfg << "{ \"servers\": [";
+    // 100 shards of 10 keys each, with a gap after every shard
+    for (int i=99; i >= 0; i--) {
+        cfg << "{ \"name\": \"server" << i << "\", \"minKey\": " << i*20 << ", \"maxKey\": " << i*20+9
+            << ", \"backups\": [\"server" << (i+1)%100 << "\"] }" << (i > 0 ? "," : "");
+    }
+    cfg << "] }";
+    cfg.close();
+
+    ft::Client* client = new ft::Client();
+    EXPECT_EQ(0, client->initialize(clientCfg));
+
+    for (unsigned long long key=0; key < 2100; key++) {
+        ft::Shard* shard = client->getShard(key);
+        if (key < 2000 && key % 20 < 10) {
+            ASSERT_NE(nullptr, shard);
+            EXPECT_EQ(key - key % 20, shard->getLowerBound());
+        } else {
+            EXPECT_EQ(nullptr, shard);
+        }
+    }
+
+    std::vector<unsigned long long> keys = { 0, 1, 25, 2, 45, 15, 1985, 1999 };
+    auto grouped = client->getShards(keys);
+    EXPECT_EQ(5, grouped.size());
+    EXPECT_EQ(3, grouped[client->getShard(0)].size());
+    EXPECT_EQ(1, grouped[client->getShard(25)].size());
+    EXPECT_EQ(1, grouped[client->getShard(45)].size());
+    EXPECT_EQ(1, grouped[client->getShard(1985)].size());
+    EXPECT_EQ(2, grouped[nullptr].size());
+}
+
+TEST(ftTest, client_assignPrimaries) {
+    LOG_LEVEL = DEBUG;
+    std::string clientCfg = "gtest_client_assign_kvcg.json";
+    std::ofstream cfg(clientCfg);
+    // Each server backs up the next one's shard
+    cfg << "{ \"servers\": [";
+    for (int i=0; i < 3; i++) {
+        cfg << "{ \"name\": \"server" << i << "\", \"minKey\": " << i*10 << ", \"maxKey\": " << i*10+9
+            << ", \"backups\": [\"server" << (i+1)%3 << "\"] }" << (i < 2 ? "," : "");
+    }
+    cfg << "] }";
+    cfg.close();
+
+    ft::Client* client = new ft::Client();
+    ASSERT_EQ(0, client->initialize(clientCfg));
+    ft::Shard* shards[3] = { client->getShard(0), client->getShard(10), client->getShard(20) };
+    for (int i=0; i < 3; i++) {
+        ASSERT_NE(nullptr, shards[i]);
+        ASSERT_EQ(2, shards[i]->getServers().size());
+    }
+    ft::Server* servers[3] = { shards[0]->getPrimary(), shards[1]->getPrimary(), shards[2]->getPrimary() };
+
+    // Everyone still owns their own shard
+    EXPECT_EQ(0, client->assignPrimaries({{{0, 9}}, {{10, 19}}, {{20, 29}}}));
+    for (int i=0; i < 3; i++) {
+        EXPECT_EQ(servers[i], shards[i]->getPrimary());
+    }
+
+    // server0 failed over to server1, and nobody owns server2's shard.
+    // The shard with no owner is an error but the others are still set.
+    EXPECT_EQ(KVCG_EUNKNOWN, client->assignPrimaries({{}, {{0, 9}, {10, 19}}, {{100, 199}, {20, 28}}}));
+    EXPECT_EQ(servers[1], shards[0]->getPrimary());
+    EXPECT_EQ(servers[1], shards[1]->getPrimary());
+    EXPECT_EQ(servers[2], shards[2]->getPrimary());
+
+    // Ownership moves back
+    EXPECT_EQ(0, client->assignPrimaries({{{0, 9}}, {{10, 19}}, {{20, 29}}}));
+    EXPECT_EQ(servers[0], shards[0]->getPrimary());
+
+    delete client;
+    remove(clientCfg.c_str());
+}
+
+TEST(ftTest, ack_policy_config) {
+    LOG_LEVEL = DEBUG;
+    std::string policyCfg = "gtest_ack_policy_kvcg.json";
+    std::ofstream cfg(policyCfg);
+    cfg << "{ \"ackPolicy\": \"quorum\", \"servers\": ["
+        << "{ \"name\": \"server0\", \"minKey\": 0, \"maxKey\": 99, \"backups\": [\"server1\", \"server2\"] },"
+        << "{ \"name\": \"server1\", \"minKey\": 100, \"maxKey\": 199, \"ackPolicy\": \"async\", \"backups\": [\"server2\"] },"
+        << "{ \"name\": \"server2\", \"minKey\": 200, \"maxKey\": 299, \"ackPolicy\": \"one\", \"backups\": [\"server0\"] }"
+        << "] }";
+    cfg.close();
+
+    KVCGConfig config;
+    ASSERT_EQ(0, config.parse_json_file(policyCfg));
+    auto policies = config.getAckPolicies();
+    ASSERT_EQ(3, policies.size());
+    EXPECT_EQ(ft::ACK_QUORUM, policies[0].second);
+    EXPECT_EQ(ft::ACK_ASYNC, policies[1].second);
+    EXPECT_EQ(ft::ACK_ONE, policies[2].second);
+    EXPECT_EQ(MAX_LOG_SIZE, config.getLogSlotSize());
+    EXPECT_EQ(0, config.getLogSlotEntries());
+    EXPECT_EQ(MAX_VALUE_SIZE, config.getMaxValueSize());
+
+    std::ofstream slotCfg(policyCfg);
+    slotCfg << "{ \"logSlotSize\": 1048576, \"logSlotEntries\": 1000, \"maxValueSize\": 8192, \"servers\": ["
+            << "{ \"name\": \"server0\", \"minKey\": 0, \"maxKey\": 99, \"backups\": [\"server1\"] }"
+            << "] }";
+    slotCfg.close();
+    KVCGConfig slotConfig;
+    ASSERT_EQ(0, slotConfig.parse_json_file(policyCfg));
+    EXPECT_EQ(1048576, slotConfig.getLogSlotSize());
+    EXPECT_EQ(1000, slotConfig.getLogSlotEntries());
+    EXPECT_EQ(8192, slotConfig.getMaxValueSize());
+
+    std::ofstream smallCfg(policyCfg);
+    smallCfg << "{ \"logSlotSize\": 64, \"servers\": ["
+             << "{ \"name\": \"server0\", \"minKey\": 0, \"maxKey\": 99, \"backups\": [\"server1\"] }"
+             << "] }";
+    smallCfg.close();
+    KVCGConfig smallConfig;
+    EXPECT_NE(0, smallConfig.parse_json_file(policyCfg));
+
+    std::ofstream badCfg(policyCfg);
+    badCfg << "{ \"servers\": ["
+           << "{ \"name\": \"server0\", \"minKey\": 0, \"maxKey\": 99, \"ackPolicy\": \"some\", \"backups\": [\"server1\"] }"
+           << "] }";
+    badCfg.close();
+    KVCGConfig badConfig;
+    EXPECT_NE(0, badConfig.parse_json_file(policyCfg));
+}
+
+TEST(ftTest, write_ahead_log) {
+    LOG_LEVEL = DEBUG;
+    std::string walDir = "gtest_wal";
+    system(("rm -rf " + walDir).c_str());
+
+    std::vector<RequestWrapper<unsigned long long, data_t *>> batch;
+    for (unsigned long long i=0; i<100; i++) {
+        std::string valueStr = "word" + std::to_string(i);
+        data_t* value = new data_t(valueStr.length()+1);
+        memcpy(value->data, valueStr.c_str(), valueStr.length()+1);
+        unsigned int requestInt = REQUEST_INSERT;
+        if (i % 10 == 0) {
+          requestInt = REQUEST_REMOVE;
+        } else if (i % 5 == 0) {
+          requestInt = REQUEST_GET;
+        }
+        RequestWrapper<unsigned long long, data_t*> pkt{i, 0, value, requestInt};
+        batch.push_back(pkt);
+    }
+
+    // Small segments, so appends roll over
+    {
+        ft::WriteAheadLog wal;
+        ASSERT_EQ(0, wal.open(walDir, "gtest", 4096));
+        for (int i=0; i<100; i+=10) {
+            std::vector<RequestWrapper<unsigned long long, data_t *>> group(batch.begin()+i, batch.begin()+i+10);
+            ASSERT_EQ(0, wal.append(group));
+        }
+    }
+
+    // Reads are not logged
+    ft::WriteAheadLog wal;
+    ASSERT_EQ(0, wal.open(walDir, "gtest", 4096));
+    std::vector<unsigned long long> keys;
+    ASSERT_EQ(0, wal.replay([&](RequestWrapper<unsigned long long, data_t *>& req) {
+        std::string expected = "word" + std::to_string(req.key);
+        EXPECT_STREQ(expected.c_str(), req.value->data);
+        EXPECT_EQ(req.key % 10 == 0 ? REQUEST_REMOVE : REQUEST_INSERT, req.requestInteger);
+        keys.push_back(req.key);
+    }));
+    ASSERT_EQ(90, keys.size());
+    for (int i=1; i < keys.size(); i++) {
+        EXPECT_LT(keys[i-1], keys[i]);
+    }
+    system(("rm -rf " + walDir).c_str());
+}
+
+TEST(ftTest, log_snapshot) {
+    LOG_LEVEL = DEBUG;
+    std::string path = "gtest_log.snap";
+    ft::LogArena arena;
+    std::map<unsigned long long, RequestWrapper<unsigned long long, data_t*>*> entries;
+    for (unsigned long long key=0; key < 1000; key+=3) {
+        std::string valueStr = "word" + std::to_string(key);
+        auto entry = arena.allocEntry(key, valueStr.length()+1);
+        memcpy(entry->value->data, valueStr.c_str(), valueStr.length()+1);
+        entry->requestInteger = (key % 2) ? REQUEST_INSERT : REQUEST_REMOVE;
+        entries[key] = entry;
+    }
+
+    ASSERT_EQ(0, ft::LogSnapshot::write(path, entries, 7, 0xabcd, 99));
+    ASSERT_EQ(0, ft::LogSnapshot::commit(path));
+
+    ft::LogSnapshot snap;
+    ASSERT_EQ(0, snap.open(path));
+    EXPECT_EQ(entries.size(), snap.size());
+    EXPECT_EQ(7, snap.getWalSegment());
+    EXPECT_EQ(0xabcd, snap.getEpoch());
+    EXPECT_EQ(99, snap.getSeq());
+    for (unsigned long long key=0; key < 1000; key++) {
+        const ft::LogSnapshot::Entry* e = snap.find(key);
+        if (key % 3) {
+            EXPECT_EQ(nullptr, e);
+            continue;
+        }
+        ASSERT_NE(nullptr, e);
+        std::string expected = "word" + std::to_string(key);
+        EXPECT_EQ(expected.length()+1, e->size);
+        EXPECT_STREQ(expected.c_str(), snap.value(e));
+        EXPECT_EQ((key % 2) ? REQUEST_INSERT : REQUEST_REMOVE, e->requestInteger);
+    }
+    snap.close();
+
+    // A count that overflows the table size is rejected
+    std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+    uint64_t count = ((uint64_t)1 << 63) + entries.size();
+    f.seekp(offsetof(ft::LogSnapshot::Header, count));
+    f.write((const char*)&count, sizeof(count));
+    f.flush();
+    EXPECT_EQ(KVCG_EINVALID, snap.open(path));
+
+    // So is an entry pointing past the end of the heap
+    count = entries.size();
+    uint64_t offset = ~0ULL;
+    f.seekp(offsetof(ft::LogSnapshot::Header, count));
+    f.write((const char*)&count, sizeof(count));
+    f.seekp(sizeof(ft::LogSnapshot::Header) + offsetof(ft::LogSnapshot::Entry, offset));
+    f.write((const char*)&offset, sizeof(offset));
+    f.close();
+    EXPECT_EQ(KVCG_EINVALID, snap.open(path));
+
+    EXPECT_EQ(KVCG_EUNAVAILABLE, snap.open("gtest_missing.snap"));
+    remove(path.c_str());
+}
+
+static int logString(ft::Server* server, unsigned long long key, std::string str) {
+    data_t* value = new data_t(str.length()+1);
+    memcpy(value->data, str.c_str(), str.length()+1);
+    return server->logRequest(key, value);
+}
+
+// Dump the trace of server and read it back
+static std::vector<ft::TraceEvent> readTrace(ft::Server* server) {
+    std::vector<ft::TraceEvent> events;
+    std::string path = "gtest_trace.bin";
+    char hdr[8 + 2*sizeof(uint64_t)];
+    uint64_t count;
+    if (server->dumpTrace(path)) {
+        return events;
+    }
+    std::ifstream in(path, std::ios::binary);
+    in.read(hdr, sizeof(hdr));
+    memcpy(&count, hdr + 8 + sizeof(uint64_t), sizeof(uint64_t));
+    events.resize(count);
+    in.read((char*)events.data(), count*sizeof(ft::TraceEvent));
+    remove(path.c_str());
+    return events;
+}
+
+// We back ourselves up in the test configs, this is the backup copy
+static std::string backupSnapPath() {
+    std::string host = boost::asio::ip::host_name();
+    return restoreSnapDir + "/" + host + "." + host + ".snap";
+}
+
+static void expectHistory(ft::LogSnapshot& snap, const std::map<unsigned long long, std::string>& expected) {
+    EXPECT_EQ(expected.size(), snap.size());
+    for (auto &kv : expected) {
+        const ft::LogSnapshot::Entry* e = snap.find(kv.first);
+        ASSERT_NE(nullptr, e);
+        EXPECT_EQ(kv.second.length()+1, e->size);
+        EXPECT_STREQ(kv.second.c_str(), snap.value(e));
+    }
+}
+
+TEST(ftTest, restore_history) {
+    LOG_LEVEL = INFO;
+    std::map<unsigned long long, std::string> history;
+    uint64_t oldEpoch;
+    {
+        // Log a history, one update at a time, and save it
+        system(("rm -rf " + restoreSnapDir).c_str());
+        ft::Server* server = new ft::Server();
+        EXPECT_EQ(0, server->initialize(restoreCfgFile));
+
+        size_t updates = 0;
+        for (unsigned long long key=0; key < 200; key++) {
+            history[key] = "v" + std::to_string(key);
+            EXPECT_EQ(0, logString(server, key, history[key]));
+            updates++;
+        }
+        for (unsigned long long key=0; key < 200; key+=3) {
+            history[key] = "w" + std::to_string(key);
+            EXPECT_EQ(0, logString(server, key, history[key]));
+            updates++;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+
+        // The backup applied every update in order
+        ASSERT_EQ(0, server->takeSnapshot());
+        ft::LogSnapshot snap;
+        ASSERT_EQ(0, snap.open(backupSnapPath()));
+        oldEpoch = snap.getEpoch();
+        EXPECT_NE(0, oldEpoch);
+        EXPECT_EQ(updates, snap.getSeq());
+        expectHistory(snap, history);
+        snap.close();
+
+        delete server;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+    }
+    ASSERT_EQ(200, history.size());
+
+    // Restart from the snapshots just saved
+    ft::Server* server = new ft::Server();
+    EXPECT_EQ(0, server->initialize(restoreCfgFile));
+
+    // Restarting started a new log stream, so the backup copy, on the old
+    // one, was sent the full history. Small entries share slot writes.
+    size_t sent = 0, writes = 0;
+    for (auto &ev : readTrace(server)) {
+        if (ev.type == ft::TRACE_LOG_SEND) sent++;
+        if (ev.type == ft::TRACE_SLOT_WRITE) writes++;
+    }
+    EXPECT_EQ(history.size(), sent);
+    EXPECT_GT(writes, 0);
+    EXPECT_LT(writes*5, sent);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+
+    ft::LogSnapshot snap;
+    ASSERT_EQ(0, server->takeSnapshot());
+    ASSERT_EQ(0, snap.open(backupSnapPath()));
+    EXPECT_NE(oldEpoch, snap.getEpoch());
+    EXPECT_EQ(history.size(), snap.getSeq());
+    expectHistory(snap, history);
+    snap.close();
+
+    // Live updates carry on from the restore without a gap
+    size_t updates = history.size();
+    for (unsigned long long key=0; key < 200; key+=7) {
+        history[key] = "x" + std::to_string(key);
+        EXPECT_EQ(0, logString(server, key, history[key]));
+        updates++;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+    ASSERT_EQ(0, server->takeSnapshot());
+    ASSERT_EQ(0, snap.open(backupSnapPath()));
+    EXPECT_EQ(updates, snap.getSeq());
+    expectHistory(snap, history);
+    snap.close();
+
+    delete server;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+}
+
+TEST(ftTest, piggyback_heartbeat) {
+    LOG_LEVEL = INFO;
+    ft::Server* server = new ft::Server();
+    EXPECT_EQ(0, server->initialize(restoreCfgFile));
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    auto idleStart = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    auto idleEnd = std::chrono::steady_clock::now();
+
+    // Log more often than the heartbeat interval, the writes stand in for heartbeats
+    auto busyStart = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - busyStart < std::chrono::milliseconds(500)) {
+        EXPECT_EQ(0, logString(server, 5, "busy"));
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    auto busyEnd = std::chrono::steady_clock::now();
+
+    auto ns = [](std::chrono::steady_clock::time_point t) {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+    };
+    size_t idle = 0, busy = 0;
+    for (auto &ev : readTrace(server)) {
+        if (ev.type != ft::TRACE_HEARTBEAT) continue;
+        if (ev.timeNs >= ns(idleStart) && ev.timeNs < ns(idleEnd)) idle++;
+        if (ev.timeNs >= ns(busyStart) && ev.timeNs < ns(busyEnd)) busy++;
+    }
+    EXPECT_GT(idle, 10);
+    EXPECT_LT(busy*4, idle);
+
+    delete server;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+}
+
+TEST(ftTest, large_value) {
+    LOG_LEVEL = INFO;
+    ft::Server* server = new ft::Server();
+    EXPECT_EQ(0, server->initialize(restoreCfgFile));
+
+    // Many times the slot size, sent in chunks
+    std::string big(3000, '\0');
+    for (size_t i=0; i < big.size()-1; i++) {
+        big[i] = 'a' + i % 26;
+    }
+    data_t* value = new data_t(big.size());
+    memcpy(value->data, big.data(), big.size());
+    EXPECT_EQ(0, server->logRequest(999, value));
+
+    // Over maxValueSize
+    data_t* huge = new data_t(70000);
+    memset(huge->data, 'h', 70000);
+    EXPECT_NE(0, server->logRequest(998, huge));
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+
+    size_t writes = 0, applied = 0;
+    for (auto &ev : readTrace(server)) {
+        if (ev.type == ft::TRACE_SLOT_WRITE) writes++;
+        if (ev.type == ft::TRACE_LOG_APPLY && ev.key == 999 && ev.arg == big.size()) applied++;
+    }
+    EXPECT_GE(writes, big.size() / 256);
+    EXPECT_EQ(1, applied);
+
+    ft::LogSnapshot snap;
+    ASSERT_EQ(0, server->takeSnapshot());
+    ASSERT_EQ(0, snap.open(backupSnapPath()));
+    const ft::LogSnapshot::Entry* e = snap.find(999);
+    ASSERT_NE(nullptr, e);
+    ASSERT_EQ(big.size(), e->size);
+    EXPECT_EQ(0, memcmp(big.data(), snap.value(e), big.size()));
+    EXPECT_EQ(nullptr, snap.find(998));
+    snap.close();
+
+    delete server;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+}
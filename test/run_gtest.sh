@@ -16,12 +16,35 @@ echo "    ]"                                    >> $test_json &&
 echo "}"                                        >> $test_json
 if [ $? -ne 0 ]; then exit 1; fi
 
+# Config for the restore tests, small log slots so values are split and
+# restores take several writes, snapshots to read back the backup copy
+restore_json="gtest_kvcg_restore.json"
+echo "{"                                        >  $restore_json &&
+echo "    \"logSlotSize\": 256,"                >> $restore_json &&
+echo "    \"maxValueSize\": 65536,"             >> $restore_json &&
+echo "    \"snapshotDir\": \"gtest_restore_snap\"," >> $restore_json &&
+echo "    \"snapshotIntervalMs\": 0,"           >> $restore_json &&
+echo "    \"traceEvents\": 65536,"              >> $restore_json &&
+echo "    \"heartbeatIntervalMs\": 20,"         >> $restore_json &&
+echo "    \"heartbeatTimeoutMs\": 1000,"        >> $restore_json &&
+echo "    \"servers\" : ["                      >> $restore_json &&
+echo "      {"                                  >> $restore_json &&
+echo "        \"name\": \"${HOSTNAME}\","       >> $restore_json &&
+echo "        \"address\": \"127.0.0.1\","      >> $restore_json &&
+echo "        \"minKey\": 0,"                   >> $restore_json &&
+echo "        \"maxKey\": 1000,"                >> $restore_json &&
+echo "        \"backups\": [\"${HOSTNAME}\"]"   >> $restore_json &&
+echo "      }"                                  >> $restore_json &&
+echo "    ]"                                    >> $restore_json &&
+echo "}"                                        >> $restore_json
+if [ $? -ne 0 ]; then exit 1; fi
+
 # Build GTest
 make clean ftTest || exit $?
 
 # Run GTest
 res=0
-testlist="ftTest.batch_mixed"
+testlist="ftTest.batch_mixed ftTest.concurrent_put ftTest.async_put ftTest.log_arena ftTest.key_range_index ftTest.key_range_discovery ftTest.client_getShard ftTest.client_assignPrimaries ftTest.ack_policy_config ftTest.write_ahead_log ftTest.log_snapshot ftTest.timer_wheel ftTest.phi_accrual ftTest.log_batch ftTest.lz ftTest.trace_ring ftTest.ft_logging ftTest.restore_history ftTest.piggyback_heartbeat ftTest.large_value"
 #ftTest.batch_mixed
 #ftTest.single_logRequest
 #ftTest.multi_put
@@ -29,7 +52,26 @@ testlist="ftTest.batch_mixed"
 #ftTest.batch_put
 #ftTest.batch_mixed
 #ftTest.bad_batch
+#ftTest.concurrent_put
+#ftTest.async_put
 #ftTest.unfold_requests
+#ftTest.log_arena
+#ftTest.key_range_index
+#ftTest.key_range_discovery
+#ftTest.client_getShard
+#ftTest.client_assignPrimaries
+#ftTest.ack_policy_config
+#ftTest.write_ahead_log
+#ftTest.log_snapshot
+#ftTest.timer_wheel
+#ftTest.phi_accrual
+#ftTest.log_batch
+#ftTest.lz
+#ftTest.trace_ring
+#ftTest.ft_logging
+#ftTest.restore_history
+#ftTest.piggyback_heartbeat
+#ftTest.large_value
 
 for test in ${testlist}; do
   ./ftTest --gtest_filter=${test}
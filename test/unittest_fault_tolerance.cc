@@ -177,6 +177,12 @@ void parseClientInput(ft::Client* client) {
           std::cout << "Shard: [" << shard->getLowerBound() << ", " << shard->getUpperBound() << "], " << shard->getPrimary()->getName() << std::endl;
           shard->discoverPrimary();
           std::cout << "Discovered primary - " << shard->getPrimary()->getName() << std::endl;
+        } else if (cmd == "r") {
+          if (client->rediscoverShards()) {
+            std::cout << "Failed to rediscover all shards" << std::endl;
+          } else {
+            std::cout << "Rediscovered all shards" << std::endl;
+          }
         } else if (cmd == "q") {
           break;
         } else {
@@ -185,6 +191,7 @@ void parseClientInput(ft::Client* client) {
           }
           std::cout << "g - get shard for key" << std::endl;
           std::cout << "d - discovery primary for shard" << std::endl;
+          std::cout << "r - rediscover primaries for all shards" << std::endl;
           std::cout << "h - print this help text" << std::endl;
           std::cout << "q - quit" << std::endl;
         }